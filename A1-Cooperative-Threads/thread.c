@@ -1,8 +1,8 @@
 #include <assert.h>
 #include <stdlib.h>
-#include <ucontext.h>
 #include <stdio.h>
 #include "thread.h"
+#include "context.h"
 
 // 1. a function for removing thread from front of queue
 /* 2. update yield() function, return -1 if yield impossible i.e
@@ -25,7 +25,7 @@ struct wait_queue {
 /* we need: rip, rsp, rbp, rdi, rsi*/
 /* we need: tid, thread_state("ready"=0 or "running"=1)*/
 struct thread {
-	ucontext_t context;
+	struct context context;
 	Tid Tid;
 	int* stack_addr;
 	int killed;
@@ -43,6 +43,9 @@ int* zombie_stack_addr = NULL;
 int returning_from_exit = 0;
 Tid yield_to;
 Tid zombie_tid = (Tid) -300;
+/* an exiting thread saves its (never resumed) context here, because its
+ * thread control block is freed before it switches away */
+struct context zombie_context;
 /**************************************************************************
  * Assignment 1: Refer to thread.h for the detailed descriptions of the six
  *               functions you need to implement. 
@@ -55,9 +58,8 @@ thread_init(void)
         /* Initialize the thread control block for the first thread */
 	/* 1. initialize thread_control_block*/
 	/*what should stackPointer be for this thread? Null?*/
+	/* its context is filled in when it first switches to another thread */
 	struct thread* init_thread = malloc(sizeof(struct thread));
-    
-	getcontext(&(init_thread->context));
     init_thread->Tid = 0;
 	init_thread->killed = 0;
 	++ num_threads_created;
@@ -89,9 +91,13 @@ thread_id()
 /* New thread starts by calling thread_stub. The arguments to thread_stub are
  * the thread_main() function, and one argument to the thread_main() function. 
  */
+void
+thread_resume_cleanup();
+
 void
 thread_stub(void (*thread_main)(void *), void *arg)
 {
+        thread_resume_cleanup();
         thread_main(arg); // call thread_main() function with arg
         thread_exit(0);
 }
@@ -131,27 +137,20 @@ thread_create(void (*fn) (void *), void *parg)
 
 	// turns out we do have space to create a thread
 	struct thread* create_thread = malloc(sizeof(struct thread));
-	getcontext(&(create_thread->context));
 
 	// what is the tid of our thread?
 	Tid create_thread_tid = available_threads[0];
 	create_thread->Tid = create_thread_tid;
 	remove_from_available();
-	/* now we have to adjust some values in our context before*/
-	// 1. rip has to point to stub function
-	create_thread->context.uc_mcontext.gregs[REG_RIP] = (unsigned long) &thread_stub;
-	// 2. save argument registers in context, these registers will hold the two arguments passed above
-	create_thread->context.uc_mcontext.gregs[REG_RDI]= (unsigned long) fn;
-	create_thread->context.uc_mcontext.gregs[REG_RSI]= (unsigned long) parg;
-	// 3. need to allocate a stack using malloc
+	// need to allocate a stack using malloc
 	int *lower_limit = malloc(THREAD_MIN_STACK);
 	if (lower_limit == NULL) {return THREAD_NOMEMORY;}
 	create_thread->stack_addr = lower_limit;
 	create_thread->killed = 0;
-	// align (unsigned long)lower_limit) + (unsigned long) (THREAD_MIN_STACK) first 
-	unsigned long upper_limit = ((unsigned long)lower_limit) + (unsigned long) (THREAD_MIN_STACK) - (unsigned long) 8;
-	// 4. change the saved stack pointer register in the context to point to the top of the new stack
-	create_thread->context.uc_mcontext.gregs[REG_RSP] = (unsigned long) upper_limit;
+	// the first switch to the new thread calls thread_stub(fn, parg) at the top of the new stack
+	unsigned long upper_limit = ((unsigned long)lower_limit) + (unsigned long) (THREAD_MIN_STACK);
+	context_init(&(create_thread->context), (void *) upper_limit,
+		     (void (*)(void *, void *)) thread_stub, fn, parg);
 
 	// add this thread to created_threads
 	created_threads[(int)create_thread_tid] = create_thread;
@@ -197,6 +196,20 @@ void append_to_available(Tid val){
 	}
 }
 
+/* Runs in a thread each time it is switched back to: frees the stack of a
+ * thread that exited while we were suspended, and exits if we were killed.
+ */
+void
+thread_resume_cleanup(){
+	if (zombie_stack_addr != NULL){
+		free(zombie_stack_addr);
+		zombie_stack_addr = NULL;
+	}
+	if (created_threads[(int) running_thread]->killed == 1){
+		thread_exit(-8);
+	}
+}
+
 Tid
 thread_yield(Tid want_tid)
 {
@@ -226,31 +239,8 @@ thread_yield(Tid want_tid)
         add_to_queue_tail(old_thread);
 		new_thread_id = new_thread->Tid;
 
-		int flag = 0;
-		getcontext(&(curr_thread->context));
-        if (zombie_stack_addr != NULL){
-            free(zombie_stack_addr);
-            zombie_stack_addr = NULL;
-        }
-        if (returning_from_exit == 1){
-            Tid old_thread = running_thread;
-            if (ready_queue[0] == (Tid) -300) {return THREAD_NONE;}
-            Tid new_thread_tid = ready_queue[0];
-            new_thread = created_threads[(int)new_thread_tid];
-		
-		    running_thread = new_thread ->Tid;
-            remove_from_queue(0);
-            add_to_queue_tail(old_thread);
-		    new_thread_id = new_thread->Tid;
-            returning_from_exit = 0;
-        }
-        if (created_threads[(int) running_thread]->killed == 1){
-            thread_exit(-8);
-        } 
-        if (flag ==0){
-		    flag=1;
-		    setcontext(&(new_thread->context));
-        }
+		context_switch(&(curr_thread->context), &(new_thread->context));
+		thread_resume_cleanup();
 		return new_thread_id;
 
 	} else if (want_tid < 0) {
@@ -271,41 +261,13 @@ thread_yield(Tid want_tid)
         remove_from_queue(index);
         add_to_queue_tail(old_thread);
 
-		int flag = 0;
-		getcontext(&(curr_thread->context));
-        if (zombie_stack_addr != NULL){
-            free(zombie_stack_addr);
-            zombie_stack_addr = NULL;
-        }
-        if ((returning_from_exit == 1) && (zombie_tid == want_tid)){
-            zombie_tid = (Tid) -300;
-            return THREAD_INVALID;
-        }
-        if (created_threads[running_thread]->killed == 1){
-            thread_exit(-8);
-        }
-        // set context
-        if (flag ==0){
-		    flag=1;
-		    setcontext(&(new_thread->context));
-        }
+		context_switch(&(curr_thread->context), &(new_thread->context));
+		thread_resume_cleanup();
     }
 	return new_thread_id;
 
 }
 
-Tid find_tail_of_queue(){
-	for (int i=0; i<THREAD_MAX_THREADS-1; ++i){
-		if (ready_queue[i+1] == (Tid)-300){
-			Tid want_tid = ready_queue[i];
-			ready_queue[i] = (Tid) -300;
-			return want_tid;
-		}
-	}
-	printf("ERROR IN FINDING TAIL OF QUEUE, CHECK EXIT FUNCTION");
-	return -1;
-}
-
 void
 thread_exit(int exit_code)
 {
@@ -318,12 +280,11 @@ thread_exit(int exit_code)
         free(created_threads[(int)running_thread]);
         created_threads[(int)running_thread] = NULL;
 
-        Tid new_context_tid = find_tail_of_queue();
-        int i = find_index_in_queue(new_context_tid);
-        remove_from_queue(i);
+        Tid new_context_tid = ready_queue[0];
+        remove_from_queue(0);
         running_thread = new_context_tid;
         returning_from_exit = 1;
-        setcontext(&(created_threads[(int)running_thread]->context));
+        context_switch(&zombie_context, &(created_threads[(int)running_thread]->context));
     }
 }
 
@@ -331,7 +292,7 @@ Tid
 thread_kill(Tid tid)
 {
 	// check if thread exists, if not return THREAD_INVALID
-	if (tid <= 0){
+	if (tid <= 0 || tid >= THREAD_MAX_THREADS){
 		return THREAD_INVALID;
 	} else if (created_threads[(int) tid] == NULL){
 		return THREAD_INVALID;
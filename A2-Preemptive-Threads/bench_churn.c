@@ -0,0 +1,90 @@
+#include <sys/resource.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures the cost of a short-lived thread: thread_create, running a thread
+ * that exits straight away, and reaping it with thread_wait. Threads are
+ * created in batches of 'batch' threads and then all waited for, so larger
+ * batches need more stacks live at the same time.
+ *
+ * For each batch size we report the average latency of one
+ * create + exit + wait cycle, and the number of minor page faults taken per
+ * thread. Once the stack pool is warm, new threads reuse stacks whose pages
+ * are already mapped and no longer fault.
+ *
+ * Timer interrupts are not enabled.
+ *****************************************************************************/
+
+#define CHURN_THREADS 20000
+
+static void
+bench_churn_thread(void *arg)
+{
+	/* touch the stack like a real thread would */
+	volatile char buf[1024];
+
+	buf[0] = 1;
+	buf[sizeof(buf) - 1] = buf[0];
+}
+
+static void
+bench_churn(int batch)
+{
+	static Tid child[THREAD_MAX_THREADS];
+	struct timespec start, end, diff;
+	struct rusage ru_start, ru_end;
+	long nsecs;
+	long faults;
+	int done;
+	int i;
+	int ret;
+
+	ret = getrusage(RUSAGE_SELF, &ru_start);
+	assert(!ret);
+	ret = clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(!ret);
+	for (done = 0; done < CHURN_THREADS; done += batch) {
+		for (i = 0; i < batch; i++) {
+			child[i] = thread_create(bench_churn_thread, NULL);
+			assert(thread_ret_ok(child[i]));
+		}
+		for (i = 0; i < batch; i++) {
+			ret = thread_wait(child[i], NULL);
+			assert(ret == child[i]);
+		}
+	}
+	ret = clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(!ret);
+	ret = getrusage(RUSAGE_SELF, &ru_end);
+	assert(!ret);
+
+	diff = timespec_sub(&end, &start);
+	nsecs = diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec;
+	faults = ru_end.ru_minflt - ru_start.ru_minflt;
+	unintr_printf("batch %4d: %6d threads, %6ld ns/thread, %6.2f faults/thread\n",
+		      batch, done, nsecs / done, (double)faults / done);
+}
+
+int
+main(int argc, char **argv)
+{
+	int batch;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting churn benchmark\n");
+	for (batch = 1; batch <= 256; batch *= 4) {
+		bench_churn(batch);
+	}
+	unintr_printf("churn benchmark done\n");
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures how the CPU is shared between NTHREADS CPU-bound threads with
+ * the weights in weights, under each scheduling policy. The threads spin
+ * for RUN_USECS with timer interrupts on, while the initial thread sleeps,
+ * and then we read the CPU time each of them got from thread_stats.
+ *
+ * We print CSV with each thread's weight, the share of the CPU its weight
+ * entitles it to, the share it got, and the ratio of the two. Under
+ * THREAD_SCHED_FAIR the ratio should be close to 1 for every thread, while
+ * THREAD_SCHED_MLFQ ignores weights and gives each thread the same share.
+ *
+ * usage: bench_fair [mlfq|fair], the default is both.
+ *****************************************************************************/
+
+#define NTHREADS 6
+#define RUN_USECS 2000000
+
+static const int weights[NTHREADS] = { 256, 512, 1024, 1024, 2048, 4096 };
+static volatile int stop;
+
+static void
+bench_fair_thread(void *arg)
+{
+	while (!stop) {
+	}
+}
+
+static void
+bench_fair(int policy, const char *name)
+{
+	struct thread_stats stats[NTHREADS];
+	struct thread_attr attr;
+	Tid child[NTHREADS];
+	double total_cpu = 0, total_weight = 0;
+	int i;
+
+	thread_set_sched(policy);
+	stop = 0;
+	thread_attr_init(&attr);
+	for (i = 0; i < NTHREADS; i++) {
+		attr.weight = weights[i];
+		child[i] = thread_create_ex(bench_fair_thread, NULL, &attr);
+		assert(thread_ret_ok(child[i]));
+		total_weight += weights[i];
+	}
+	thread_sleep_for(RUN_USECS);
+	for (i = 0; i < NTHREADS; i++) {
+		assert(thread_stats(child[i], &stats[i]) == child[i]);
+		total_cpu += stats[i].cpu_ns;
+	}
+	stop = 1;
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		double expected = weights[i] / total_weight;
+		double share = stats[i].cpu_ns / total_cpu;
+
+		printf("%s,%d,%d,%.4f,%.4f,%.3f\n", name, i, weights[i],
+		       expected, share, share / expected);
+	}
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+
+	printf("sched,thread,weight,expected_share,cpu_share,ratio\n");
+	if (argc < 2 || strcmp(argv[1], "mlfq") == 0) {
+		bench_fair(THREAD_SCHED_MLFQ, "mlfq");
+	}
+	if (argc < 2 || strcmp(argv[1], "fair") == 0) {
+		bench_fair(THREAD_SCHED_FAIR, "fair");
+	}
+	return 0;
+}
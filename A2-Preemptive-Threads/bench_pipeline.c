@@ -0,0 +1,245 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Passes NMSGS messages down a pipeline: a source thread, a chain of stage
+ * threads that each receive a message, do a little work on it and send it
+ * on, and a sink thread. Stages are connected by channels, or by the bounded
+ * queue under a lock and two condition variables that a program would write
+ * by hand without them.
+ *
+ * With channels, a stage that sends to the next, waiting stage hands the
+ * message straight to it and keeps running, without touching the buffer.
+ * With the hand-rolled queue every message is copied into the buffer, and
+ * the receiver is only made ready by a cv_signal that first has to take the
+ * lock. We print CSV with the messages
+ * per second for each queue, buffer capacity and number of stages.
+ *
+ * Set THREAD_WORKERS to run the stages on several kernel threads.
+ *****************************************************************************/
+
+#define NMSGS 200000
+#define MAX_STAGES 16
+
+/* the hand-rolled queue */
+struct queue {
+	struct lock *lock;
+	struct cv *not_empty;
+	struct cv *not_full;
+	void **buf;
+	int capacity;
+	int head;
+	int count;
+	bool closed;
+};
+
+static struct queue *
+queue_create(int capacity)
+{
+	struct queue *q = malloc369(sizeof(struct queue));
+
+	assert(q != NULL);
+	q->lock = lock_create();
+	q->not_empty = cv_create();
+	q->not_full = cv_create();
+	q->buf = malloc369(capacity * sizeof(void *));
+	assert(q->buf != NULL);
+	q->capacity = capacity;
+	q->head = 0;
+	q->count = 0;
+	q->closed = false;
+	return q;
+}
+
+static void
+queue_destroy(struct queue *q)
+{
+	cv_destroy(q->not_empty);
+	cv_destroy(q->not_full);
+	lock_destroy(q->lock);
+	free369(q->buf);
+	free369(q);
+}
+
+static void
+queue_send(struct queue *q, void *msg)
+{
+	lock_acquire(q->lock);
+	while (q->count == q->capacity) {
+		cv_wait(q->not_full, q->lock);
+	}
+	q->buf[(q->head + q->count) % q->capacity] = msg;
+	q->count++;
+	cv_signal(q->not_empty, q->lock);
+	lock_release(q->lock);
+}
+
+static int
+queue_recv(struct queue *q, void **msg)
+{
+	lock_acquire(q->lock);
+	while (q->count == 0 && !q->closed) {
+		cv_wait(q->not_empty, q->lock);
+	}
+	if (q->count == 0) {
+		lock_release(q->lock);
+		return 0;
+	}
+	*msg = q->buf[q->head];
+	q->head = (q->head + 1) % q->capacity;
+	q->count--;
+	cv_signal(q->not_full, q->lock);
+	lock_release(q->lock);
+	return 1;
+}
+
+static void
+queue_close(struct queue *q)
+{
+	lock_acquire(q->lock);
+	q->closed = true;
+	cv_broadcast(q->not_empty, q->lock);
+	lock_release(q->lock);
+}
+
+/* link i connects stage i - 1 (or the source) to stage i (or the sink) */
+static bool use_chan;
+static struct chan *chans[MAX_STAGES + 1];
+static struct queue *queues[MAX_STAGES + 1];
+static long sink_sum;
+
+static void
+link_send(int i, void *msg)
+{
+	if (use_chan) {
+		chan_send(chans[i], msg);
+	} else {
+		queue_send(queues[i], msg);
+	}
+}
+
+static int
+link_recv(int i, void **msg)
+{
+	return use_chan ? chan_recv(chans[i], msg) : queue_recv(queues[i], msg);
+}
+
+static void
+link_close(int i)
+{
+	if (use_chan) {
+		chan_close(chans[i]);
+	} else {
+		queue_close(queues[i]);
+	}
+}
+
+static void
+bench_source(void *arg)
+{
+	long i;
+
+	for (i = 1; i <= NMSGS; i++) {
+		link_send(0, (void *)i);
+	}
+	link_close(0);
+}
+
+static void
+bench_stage(void *arg)
+{
+	int i = (long)arg;
+	void *msg;
+
+	while (link_recv(i, &msg)) {
+		link_send(i + 1, (void *)((long)msg * 3 % 1000003));
+	}
+	link_close(i + 1);
+}
+
+static void
+bench_sink(void *arg)
+{
+	int i = (long)arg;
+	long sum = 0;
+	void *msg;
+
+	while (link_recv(i, &msg)) {
+		sum += (long)msg;
+	}
+	sink_sum = sum;
+}
+
+static void
+bench_pipeline(bool chan, int capacity, int nstages)
+{
+	static Tid child[MAX_STAGES + 2];
+	struct timespec start, end, diff;
+	double secs;
+	long i;
+
+	use_chan = chan;
+	for (i = 0; i <= nstages; i++) {
+		if (chan) {
+			chans[i] = chan_create(capacity);
+		} else {
+			queues[i] = queue_create(capacity);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	child[0] = thread_create(bench_source, NULL);
+	for (i = 0; i < nstages; i++) {
+		child[i + 1] = thread_create(bench_stage, (void *)i);
+	}
+	child[nstages + 1] = thread_create(bench_sink, (void *)(long)nstages);
+	for (i = 0; i < nstages + 2; i++) {
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < nstages + 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	diff = timespec_sub(&end, &start);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+	printf("%s,%d,%d,%.0f\n", chan ? "chan" : "lock_cv", capacity, nstages,
+	       NMSGS / secs);
+	fflush(stdout);
+	for (i = 0; i <= nstages; i++) {
+		if (chan) {
+			chan_destroy(chans[i]);
+		} else {
+			queue_destroy(queues[i]);
+		}
+	}
+	/* keep the stages' work from being optimized away */
+	if (sink_sum == -1) {
+		printf("%ld\n", sink_sum);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int capacities[] = { 1, 16, 256 };
+	int nstages;
+	int c;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	printf("queue,capacity,stages,msgs_per_sec\n");
+	for (nstages = 1; nstages <= MAX_STAGES; nstages *= 4) {
+		bench_pipeline(true, 0, nstages);
+		for (c = 0; c < 3; c++) {
+			bench_pipeline(true, capacities[c], nstages);
+			bench_pipeline(false, capacities[c], nstages);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Runs NTASKS tiny tasks, each of which adds its argument to a sum, in
+ * batches of BATCH tasks that are all started before any is waited for:
+ *
+ * - create: a thread_create per task and a thread_wait to reap it, so each
+ *   task costs a thread's whole lifecycle.
+ * - pool: pool_submit per task to a pool of POOL_THREADS threads, and
+ *   future_get to collect its result, so each task costs a queue push and a
+ *   recycled future.
+ *
+ * We print CSV with the tasks per second and the time per task for each.
+ *
+ * Set THREAD_WORKERS to run the threads on several kernel threads.
+ *****************************************************************************/
+
+#define NTASKS 1000000
+#define BATCH 500		/* divides NTASKS */
+#define POOL_THREADS 8
+
+static long sum;
+
+static void *
+bench_task(void *arg)
+{
+	__atomic_add_fetch(&sum, (long)arg, __ATOMIC_RELAXED);
+	return arg;
+}
+
+static void
+bench_thread(void *arg)
+{
+	bench_task(arg);
+}
+
+static void
+bench_create(void)
+{
+	static Tid child[BATCH];
+	long i, j;
+
+	for (i = 0; i < NTASKS; i += BATCH) {
+		for (j = 0; j < BATCH; j++) {
+			child[j] = thread_create(bench_thread, (void *)(i + j));
+			assert(thread_ret_ok(child[j]));
+		}
+		for (j = 0; j < BATCH; j++) {
+			thread_wait(child[j], NULL);
+		}
+	}
+}
+
+static void
+bench_pool(void)
+{
+	static struct future *f[BATCH];
+	struct pool *pool;
+	long i, j;
+
+	pool = pool_create(POOL_THREADS);
+	assert(pool != NULL);
+	for (i = 0; i < NTASKS; i += BATCH) {
+		for (j = 0; j < BATCH; j++) {
+			f[j] = pool_submit(pool, bench_task, (void *)(i + j));
+		}
+		for (j = 0; j < BATCH; j++) {
+			assert(future_get(f[j]) == (void *)(i + j));
+		}
+	}
+	pool_destroy(pool);
+}
+
+static void
+bench_run(const char *name, void (*fn)(void))
+{
+	struct timespec start, end, diff;
+	double secs;
+
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fn();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(sum == (long)NTASKS * (NTASKS - 1) / 2);
+	diff = timespec_sub(&end, &start);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+	printf("%s,%d,%.0f,%.1f\n", name, NTASKS, NTASKS / secs,
+	       secs * 1e9 / NTASKS);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	printf("benchmark,tasks,tasks_per_sec,ns_per_task\n");
+	bench_run("create", bench_create);
+	bench_run("pool", bench_pool);
+	return 0;
+}
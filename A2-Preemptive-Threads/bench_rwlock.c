@@ -0,0 +1,140 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Compares a reader-writer lock with a plain lock protecting a read-mostly
+ * table. Each thread does a mix of 90% reads and 10% writes. A read holds the
+ * lock while it scans part of the table and yields once, which stands in for
+ * a reader that blocks or is preempted in its critical section. A write
+ * updates one entry.
+ *
+ * With the plain lock every reader that yields keeps all the other threads
+ * out, so throughput stays flat as threads are added. With the rwlock the
+ * readers share the lock and keep running while one of them is switched
+ * out, so reader throughput grows with the number of threads, until the
+ * writers' share of the lock dominates. We print CSV with the reads and
+ * writes per second for each lock and thread count, from 1 to MAX_THREADS.
+ *
+ * Set THREAD_WORKERS to run the threads on several kernel threads.
+ *****************************************************************************/
+
+#define MAX_THREADS 64
+#define OPS 400000		/* ops per lock type and thread count */
+#define WRITE_PERCENT 10
+#define TABLE_SIZE 64
+#define SCAN 16			/* entries read per read */
+
+static long table[TABLE_SIZE];
+static struct lock *lock;
+static struct rwlock *rw;
+static bool use_rwlock;
+static int rounds;
+static long nreads;
+static long nwrites;
+
+static void
+bench_rwlock_thread(void *arg)
+{
+	unsigned long x = (long)arg + 1;
+	long reads = 0, writes = 0;
+	long sum = 0;
+	int i, j;
+
+	for (i = 0; i < rounds; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		if (x % 100 < WRITE_PERCENT) {
+			if (use_rwlock) {
+				rwlock_wrlock(rw);
+			} else {
+				lock_acquire(lock);
+			}
+			table[x % TABLE_SIZE]++;
+			if (use_rwlock) {
+				rwlock_unlock(rw);
+			} else {
+				lock_release(lock);
+			}
+			writes++;
+		} else {
+			if (use_rwlock) {
+				rwlock_rdlock(rw);
+			} else {
+				lock_acquire(lock);
+			}
+			for (j = 0; j < SCAN; j++) {
+				sum += table[(x + j) % TABLE_SIZE];
+			}
+			thread_yield(THREAD_ANY);
+			if (use_rwlock) {
+				rwlock_unlock(rw);
+			} else {
+				lock_release(lock);
+			}
+			reads++;
+		}
+	}
+	__atomic_add_fetch(&nreads, reads, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&nwrites, writes, __ATOMIC_RELAXED);
+	/* keep the reads from being optimized away */
+	if (sum == -1) {
+		printf("%ld\n", sum);
+	}
+}
+
+static void
+bench_rwlock(bool rwlock, int nthreads)
+{
+	static Tid child[MAX_THREADS];
+	struct timespec start, end, diff;
+	double secs;
+	long i;
+
+	use_rwlock = rwlock;
+	rounds = OPS / nthreads;
+	nreads = 0;
+	nwrites = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* the initial thread takes part too */
+	for (i = 1; i < nthreads; i++) {
+		child[i] = thread_create(bench_rwlock_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	bench_rwlock_thread((void *)0);
+	for (i = 1; i < nthreads; i++) {
+		thread_wait(child[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	diff = timespec_sub(&end, &start);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+	printf("%s,%d,%.0f,%.0f\n", rwlock ? "rwlock" : "lock", nthreads,
+	       nreads / secs, nwrites / secs);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	lock = lock_create();
+	rw = rwlock_create();
+	printf("lock,threads,reads_per_sec,writes_per_sec\n");
+	for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+		bench_rwlock(false, nthreads);
+		bench_rwlock(true, nthreads);
+	}
+	rwlock_destroy(rw);
+	lock_destroy(lock);
+	return 0;
+}
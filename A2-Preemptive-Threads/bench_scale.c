@@ -0,0 +1,127 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures how a CPU-bound fan-out scales with the number of kernel worker
+ * threads in M:N mode. The initial thread creates NTHREADS threads that
+ * split a fixed amount of work between them, and waits for all of them.
+ *
+ * thread_init can only run once per process, so every worker count is
+ * measured in a child process. We report, as CSV, the wall-clock time, the
+ * speedup over one worker, and the CPU time used per unit of wall-clock
+ * time, which is the number of workers that were actually busy.
+ *
+ * usage: bench_scale [max_workers], the default is the number of CPUs.
+ *****************************************************************************/
+
+#define NTHREADS 64
+#define WORK 200000000UL	/* iterations, split over all the threads */
+#define CHUNK 100000		/* iterations between yields */
+
+static unsigned long result[NTHREADS];
+
+static void
+bench_scale_thread(void *arg)
+{
+	long id = (long)arg;
+	unsigned long x = id + 1;
+	unsigned long i;
+
+	/* xorshift, so the compiler cannot shortcut the loop */
+	for (i = 0; i < WORK / NTHREADS; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		/* a thread that yields may be picked up by an idle worker,
+		 * while a preempted thread stays on its worker */
+		if (i % CHUNK == 0) {
+			thread_yield(THREAD_ANY);
+		}
+	}
+	result[id] = x;
+}
+
+/* Runs the fan-out on nworkers workers, in a child process. */
+static void
+bench_scale(int nworkers)
+{
+	Tid child[NTHREADS];
+	long i;
+
+	init_csc369_malloc(false);
+	thread_init_workers(nworkers);
+	register_interrupt_handler(false);
+
+	for (i = 0; i < NTHREADS; i++) {
+		child[i] = thread_create(bench_scale_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	exit(0);
+}
+
+static double
+tv_sec(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec start, end, diff;
+	struct rusage usage;
+	double seconds, base = 0;
+	int max_workers;
+	int nworkers;
+	int status;
+	pid_t pid;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+
+	max_workers = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_workers < 1 || max_workers > THREAD_MAX_WORKERS) {
+		fprintf(stderr, "usage: %s [1-%d]\n", argv[0], THREAD_MAX_WORKERS);
+		return 1;
+	}
+
+	printf("starting scale benchmark, %d threads, %d CPUs\n", NTHREADS,
+	       (int)sysconf(_SC_NPROCESSORS_ONLN));
+	printf("workers,seconds,speedup,busy_workers\n");
+	fflush(stdout);
+	for (nworkers = 1; ; nworkers *= 2) {
+		if (nworkers > max_workers) {
+			nworkers = max_workers;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			bench_scale(nworkers);
+		}
+		wait4(pid, &status, 0, &usage);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		diff = timespec_sub(&end, &start);
+		seconds = diff.tv_sec + diff.tv_nsec / 1e9;
+		if (nworkers == 1) {
+			base = seconds;
+		}
+		printf("%d,%.3f,%.2f,%.2f\n", nworkers, seconds, base / seconds,
+		       (tv_sec(&usage.ru_utime) + tv_sec(&usage.ru_stime)) /
+		       seconds);
+		fflush(stdout);
+		if (nworkers == max_workers) {
+			break;
+		}
+	}
+	printf("scale benchmark done\n");
+	return 0;
+}
@@ -0,0 +1,606 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Scheduler microbenchmark suite, run by 'make bench'. For 2 to 1024 threads
+ * (counting the initial thread) it measures:
+ *
+ *	yield		a thread_yield(THREAD_ANY) round robin; an op is the
+ *			time from one thread resuming to the next one resuming
+ *	churn		thread_create, a thread that exits straight away, and
+ *			thread_wait, in batches of threads-1 children; an op is
+ *			one thread, averaged over a batch
+ *	lock		contended lock_acquire / lock_release, where every
+ *			holder yields in the critical section and after
+ *			releasing; an op is the time from a release to the
+ *			next acquire by another thread
+ *	lock_handoff	the same with a LOCK_HANDOFF lock
+ *	lock_adaptive	the same with a LOCK_HANDOFF | LOCK_ADAPTIVE lock
+ *	cv_signal	a token passed around a ring of threads with
+ *			cv_signal; an op is the time from one thread taking
+ *			the token to the next thread taking it
+ *	cv_broadcast	one thread wakes all the others with cv_broadcast; an
+ *			op is the time from the broadcast until one waiter
+ *			runs, so the high percentiles are the fan-out time
+ *	sem_pc		half the threads produce and half consume through a
+ *			bounded buffer guarded by semaphores; an op is one
+ *			item, sampled from its production to its consumption
+ *	cv_pc		the same with a lock and two condition variables
+ *	barrier		every thread passes a barrier over and over; an op is
+ *			one thread passing it, and the samples are the time
+ *			of a whole phase
+ *	cv_barrier	the same with a lock, a counter and cv_broadcast
+ *
+ * and prints one CSV row per benchmark and thread count, with the mean time
+ * per op and the percentiles of the per-op samples, all in nanoseconds.
+ * Benchmarks can be selected by name on the command line.
+ *
+ * Timer interrupts are not enabled, so the threads only switch where the
+ * benchmark makes them switch.
+ *****************************************************************************/
+
+#define MIN_THREADS 2
+#define MAX_THREADS THREAD_MAX_THREADS
+#define OPS 100000		/* ops per benchmark and thread count */
+#define CHURN_OPS 20000
+#define MAX_SAMPLES (OPS + MAX_THREADS)
+
+static long samples[MAX_SAMPLES];
+static int nsamples;
+static Tid child[MAX_THREADS];
+
+static long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void
+sample(long ns)
+{
+	int i = __atomic_fetch_add(&nsamples, 1, __ATOMIC_RELAXED);
+
+	if (i < MAX_SAMPLES) {
+		samples[i] = ns;
+	}
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Prints the CSV row for a run of nops ops that took elapsed ns. */
+static void
+report(const char *name, int nthreads, long nops, long elapsed)
+{
+	int n = nsamples < MAX_SAMPLES ? nsamples : MAX_SAMPLES;
+
+	assert(n > 0);
+	qsort(samples, n, sizeof(long), cmp_long);
+	printf("%s,%d,%ld,%.1f,%ld,%ld,%ld,%ld\n", name, nthreads, nops,
+	       (double)elapsed / nops, samples[n / 2], samples[n * 9 / 10],
+	       samples[n * 99 / 100], samples[n - 1]);
+	fflush(stdout);
+}
+
+/* shared by the benchmarks */
+static int rounds;
+static volatile long last_stamp;
+static struct lock *lock;
+
+/* Creates nthreads-1 children running fn, and runs fn in this thread too.
+ * Samples start once all the children are created. */
+static void
+run_all(int nthreads, void (*fn)(void *))
+{
+	int i;
+
+	for (i = 1; i < nthreads; i++) {
+		child[i] = thread_create(fn, (void *)(long)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	nsamples = 0;
+	last_stamp = now_ns();
+	fn((void *)0);
+	for (i = 1; i < nthreads; i++) {
+		thread_wait(child[i], NULL);
+	}
+}
+
+/* yield */
+
+static void
+bench_yield_thread(void *arg)
+{
+	long stamp;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		thread_yield(THREAD_ANY);
+		stamp = now_ns();
+		sample(stamp - last_stamp);
+		last_stamp = stamp;
+	}
+}
+
+static void
+bench_yield(int nthreads)
+{
+	long start;
+
+	rounds = OPS / nthreads + 1;
+	start = now_ns();
+	run_all(nthreads, bench_yield_thread);
+	report("yield", nthreads, (long)rounds * nthreads, now_ns() - start);
+}
+
+/* churn */
+
+static void
+bench_churn_thread(void *arg)
+{
+}
+
+static void
+bench_churn(int nthreads)
+{
+	long start, batch_start, elapsed;
+	int batch = nthreads - 1;
+	int done, i;
+
+	nsamples = 0;
+	start = now_ns();
+	for (done = 0; done < CHURN_OPS; done += batch) {
+		batch_start = now_ns();
+		for (i = 0; i < batch; i++) {
+			child[i] = thread_create(bench_churn_thread, NULL);
+			assert(thread_ret_ok(child[i]));
+		}
+		for (i = 0; i < batch; i++) {
+			thread_wait(child[i], NULL);
+		}
+		sample((now_ns() - batch_start) / batch);
+	}
+	elapsed = now_ns() - start;
+	report("churn", nthreads, done, elapsed);
+}
+
+/* lock */
+
+static volatile Tid last_holder;
+
+static void
+bench_lock_thread(void *arg)
+{
+	long stamp;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		lock_acquire(lock);
+		stamp = now_ns();
+		if (last_holder != thread_id()) {
+			sample(stamp - last_stamp);
+		}
+		/* make the others queue up on the lock */
+		thread_yield(THREAD_ANY);
+		last_holder = thread_id();
+		last_stamp = now_ns();
+		lock_release(lock);
+		thread_yield(THREAD_ANY);
+	}
+}
+
+static void
+bench_lock_flags(const char *name, int flags, int nthreads)
+{
+	long start;
+
+	rounds = OPS / nthreads + 1;
+	lock = lock_create_flags(flags);
+	last_holder = THREAD_NONE;
+	start = now_ns();
+	run_all(nthreads, bench_lock_thread);
+	report(name, nthreads, (long)rounds * nthreads, now_ns() - start);
+	lock_destroy(lock);
+}
+
+static void
+bench_lock(int nthreads)
+{
+	bench_lock_flags("lock", 0, nthreads);
+}
+
+static void
+bench_lock_handoff(int nthreads)
+{
+	bench_lock_flags("lock_handoff", LOCK_HANDOFF, nthreads);
+}
+
+static void
+bench_lock_adaptive(int nthreads)
+{
+	bench_lock_flags("lock_adaptive", LOCK_ADAPTIVE | LOCK_HANDOFF,
+			 nthreads);
+}
+
+/* cv_signal */
+
+static struct cv *ring[MAX_THREADS];
+static volatile int turn;
+static int ring_size;
+
+static void
+bench_cv_signal_thread(void *arg)
+{
+	int me = (long)arg;
+	long stamp;
+	int i;
+
+	lock_acquire(lock);
+	for (i = 0; i < rounds; i++) {
+		while (turn != me) {
+			cv_wait(ring[me], lock);
+		}
+		stamp = now_ns();
+		sample(stamp - last_stamp);
+		last_stamp = stamp;
+		turn = (me + 1) % ring_size;
+		cv_signal(ring[turn], lock);
+	}
+	lock_release(lock);
+}
+
+static void
+bench_cv_signal(int nthreads)
+{
+	long start;
+	int i;
+
+	rounds = OPS / nthreads + 1;
+	ring_size = nthreads;
+	lock = lock_create();
+	for (i = 0; i < nthreads; i++) {
+		ring[i] = cv_create();
+	}
+	turn = 0;
+	start = now_ns();
+	run_all(nthreads, bench_cv_signal_thread);
+	report("cv_signal", nthreads, (long)rounds * nthreads, now_ns() - start);
+	for (i = 0; i < nthreads; i++) {
+		cv_destroy(ring[i]);
+	}
+	lock_destroy(lock);
+}
+
+/* cv_broadcast */
+
+static struct cv *go;		/* waiters wait for the next broadcast */
+static struct cv *ready;	/* the broadcaster waits for the waiters */
+static volatile int generation;
+static volatile int nwaiting;
+static int nwaiters;
+
+static void
+bench_cv_broadcast_thread(void *arg)
+{
+	int me = (long)arg;
+	int gen;
+	int i;
+
+	lock_acquire(lock);
+	for (i = 0; i < rounds; i++) {
+		if (me == 0) {
+			/* the initial thread broadcasts */
+			while (nwaiting < nwaiters) {
+				cv_wait(ready, lock);
+			}
+			nwaiting = 0;
+			generation++;
+			last_stamp = now_ns();
+			cv_broadcast(go, lock);
+		} else {
+			gen = generation;
+			if (++nwaiting == nwaiters) {
+				cv_signal(ready, lock);
+			}
+			while (generation == gen) {
+				cv_wait(go, lock);
+			}
+			sample(now_ns() - last_stamp);
+		}
+	}
+	lock_release(lock);
+}
+
+static void
+bench_cv_broadcast(int nthreads)
+{
+	long start;
+
+	nwaiters = nthreads - 1;
+	rounds = OPS / nwaiters + 1;
+	lock = lock_create();
+	go = cv_create();
+	ready = cv_create();
+	nwaiting = 0;
+	generation = 0;
+	start = now_ns();
+	run_all(nthreads, bench_cv_broadcast_thread);
+	report("cv_broadcast", nthreads, (long)rounds * nwaiters,
+	       now_ns() - start);
+	cv_destroy(go);
+	cv_destroy(ready);
+	lock_destroy(lock);
+}
+
+/* sem_pc, cv_pc */
+
+#define PC_BUFSIZE 16
+
+static long pc_buffer[PC_BUFSIZE];	/* the time each item was produced */
+static int pc_head, pc_tail, pc_count;
+static struct semaphore *pc_empty, *pc_full, *pc_mutex;
+static struct cv *pc_not_full, *pc_not_empty;
+
+static void
+bench_sem_pc_thread(void *arg)
+{
+	bool producer = (long)arg % 2 == 0;
+	long stamp;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		if (producer) {
+			semaphore_down(pc_empty);
+			semaphore_down(pc_mutex);
+			pc_buffer[pc_tail] = now_ns();
+			pc_tail = (pc_tail + 1) % PC_BUFSIZE;
+			semaphore_up(pc_mutex);
+			semaphore_up(pc_full);
+		} else {
+			semaphore_down(pc_full);
+			semaphore_down(pc_mutex);
+			stamp = pc_buffer[pc_head];
+			pc_head = (pc_head + 1) % PC_BUFSIZE;
+			semaphore_up(pc_mutex);
+			semaphore_up(pc_empty);
+			sample(now_ns() - stamp);
+		}
+	}
+}
+
+static void
+bench_cv_pc_thread(void *arg)
+{
+	bool producer = (long)arg % 2 == 0;
+	long stamp;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		lock_acquire(lock);
+		if (producer) {
+			while (pc_count == PC_BUFSIZE) {
+				cv_wait(pc_not_full, lock);
+			}
+			pc_buffer[pc_tail] = now_ns();
+			pc_tail = (pc_tail + 1) % PC_BUFSIZE;
+			pc_count++;
+			cv_signal(pc_not_empty, lock);
+			lock_release(lock);
+		} else {
+			while (pc_count == 0) {
+				cv_wait(pc_not_empty, lock);
+			}
+			stamp = pc_buffer[pc_head];
+			pc_head = (pc_head + 1) % PC_BUFSIZE;
+			pc_count--;
+			cv_signal(pc_not_full, lock);
+			lock_release(lock);
+			sample(now_ns() - stamp);
+		}
+	}
+}
+
+static void
+bench_pc(bool sem, int nthreads)
+{
+	long start;
+
+	/* half of the threads produce, and half consume */
+	rounds = 2 * OPS / nthreads + 1;
+	pc_head = pc_tail = pc_count = 0;
+	if (sem) {
+		pc_empty = semaphore_create(PC_BUFSIZE);
+		pc_full = semaphore_create(0);
+		pc_mutex = semaphore_create(1);
+	} else {
+		lock = lock_create();
+		pc_not_full = cv_create();
+		pc_not_empty = cv_create();
+	}
+	start = now_ns();
+	run_all(nthreads, sem ? bench_sem_pc_thread : bench_cv_pc_thread);
+	report(sem ? "sem_pc" : "cv_pc", nthreads, (long)rounds * nthreads / 2,
+	       now_ns() - start);
+	if (sem) {
+		semaphore_destroy(pc_empty);
+		semaphore_destroy(pc_full);
+		semaphore_destroy(pc_mutex);
+	} else {
+		cv_destroy(pc_not_full);
+		cv_destroy(pc_not_empty);
+		lock_destroy(lock);
+	}
+}
+
+static void
+bench_sem_pc(int nthreads)
+{
+	bench_pc(true, nthreads);
+}
+
+static void
+bench_cv_pc(int nthreads)
+{
+	bench_pc(false, nthreads);
+}
+
+/* barrier, cv_barrier */
+
+static struct barrier *barrier;
+static int arrived;
+
+/* Passes the barrier, or its lock + cv equivalent. Returns whether we were
+ * the last thread to arrive. */
+static int
+pass_barrier(bool native, int nthreads)
+{
+	int gen;
+
+	if (native) {
+		return barrier_wait(barrier);
+	}
+	lock_acquire(lock);
+	if (++arrived == nthreads) {
+		arrived = 0;
+		generation++;
+		cv_broadcast(go, lock);
+		lock_release(lock);
+		return 1;
+	}
+	gen = generation;
+	while (generation == gen) {
+		cv_wait(go, lock);
+	}
+	lock_release(lock);
+	return 0;
+}
+
+static bool barrier_native;
+static int barrier_threads;
+
+static void
+bench_barrier_thread(void *arg)
+{
+	long stamp;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		if (pass_barrier(barrier_native, barrier_threads)) {
+			stamp = now_ns();
+			sample(stamp - last_stamp);
+			last_stamp = stamp;
+		}
+	}
+}
+
+static void
+bench_barrier_common(bool native, int nthreads)
+{
+	long start;
+
+	rounds = OPS / nthreads + 1;
+	barrier_native = native;
+	barrier_threads = nthreads;
+	if (native) {
+		barrier = barrier_create(nthreads);
+	} else {
+		lock = lock_create();
+		go = cv_create();
+		arrived = 0;
+		generation = 0;
+	}
+	start = now_ns();
+	run_all(nthreads, bench_barrier_thread);
+	report(native ? "barrier" : "cv_barrier", nthreads,
+	       (long)rounds * nthreads, now_ns() - start);
+	if (native) {
+		barrier_destroy(barrier);
+	} else {
+		cv_destroy(go);
+		lock_destroy(lock);
+	}
+}
+
+static void
+bench_barrier(int nthreads)
+{
+	bench_barrier_common(true, nthreads);
+}
+
+static void
+bench_cv_barrier(int nthreads)
+{
+	bench_barrier_common(false, nthreads);
+}
+
+static struct {
+	const char *name;
+	void (*fn)(int nthreads);
+} benchmarks[] = {
+	{ "yield", bench_yield },
+	{ "churn", bench_churn },
+	{ "lock", bench_lock },
+	{ "lock_handoff", bench_lock_handoff },
+	{ "lock_adaptive", bench_lock_adaptive },
+	{ "cv_signal", bench_cv_signal },
+	{ "cv_broadcast", bench_cv_broadcast },
+	{ "sem_pc", bench_sem_pc },
+	{ "cv_pc", bench_cv_pc },
+	{ "barrier", bench_barrier },
+	{ "cv_barrier", bench_cv_barrier },
+};
+
+#define NBENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static bool
+selected(const char *name, int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2) {
+		return true;
+	}
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads;
+	unsigned int b;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	printf("benchmark,threads,ops,ns_per_op,p50_ns,p90_ns,p99_ns,max_ns\n");
+	for (b = 0; b < NBENCHMARKS; b++) {
+		if (!selected(benchmarks[b].name, argc, argv)) {
+			continue;
+		}
+		for (nthreads = MIN_THREADS; nthreads <= MAX_THREADS;
+		     nthreads *= 2) {
+			benchmarks[b].fn(nthreads);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures what an idle thread costs for a range of stack sizes: NTHREADS
+ * threads are created with thread_create_ex, each touches TOUCH_BYTES of its
+ * stack, as a connection handler that parsed a request might, and then they
+ * all block on a semaphore at once. Stacks of up to 512KB come from the
+ * shared slabs, larger ones are mapped on their own.
+ *
+ * We print CSV with the time to create a thread, and the address space and
+ * resident memory per idle thread, for each stack size. Only the pages a
+ * thread touched should be resident, whatever its stack size.
+ *****************************************************************************/
+
+#define NTHREADS 10000
+#define TOUCH_BYTES 4096
+
+static struct semaphore *sem;
+
+static void
+bench_idle_thread(void *arg)
+{
+	volatile char buf[TOUCH_BYTES];
+
+	buf[0] = 1;
+	buf[TOUCH_BYTES - 1] = 1;
+	semaphore_down(sem);
+	assert(buf[0] == buf[TOUCH_BYTES - 1]);
+}
+
+/* Reads the size and the resident set size of the process, in bytes. */
+static void
+process_bytes(long *size, long *resident)
+{
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	assert(f != NULL);
+	assert(fscanf(f, "%ld %ld", size, resident) == 2);
+	fclose(f);
+	*size *= sysconf(_SC_PAGESIZE);
+	*resident *= sysconf(_SC_PAGESIZE);
+}
+
+static void
+bench_stack(size_t stack_size)
+{
+	static Tid child[NTHREADS];
+	struct timespec start, end, diff;
+	long size[2], resident[2];
+	struct thread_attr attr;
+	double secs;
+	int i;
+
+	thread_attr_init(&attr);
+	attr.stack_size = stack_size;
+	process_bytes(&size[0], &resident[0]);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NTHREADS; i++) {
+		child[i] = thread_create_ex(bench_idle_thread, NULL, &attr);
+		assert(thread_ret_ok(child[i]));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	/* let them all run and go to sleep */
+	for (i = 0; i < NTHREADS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	process_bytes(&size[1], &resident[1]);
+	for (i = 0; i < NTHREADS; i++) {
+		semaphore_up(sem);
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	diff = timespec_sub(&end, &start);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+	printf("%zu,%d,%.0f,%ld,%ld\n", stack_size / 1024, NTHREADS,
+	       secs * 1e9 / NTHREADS, (size[1] - size[0]) / NTHREADS,
+	       (resident[1] - resident[0]) / NTHREADS);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const size_t sizes[] = {
+		THREAD_STACK_FLOOR, THREAD_MIN_STACK, 64 << 10, 256 << 10,
+		1 << 20, 8 << 20
+	};
+	unsigned int i;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	assert(thread_set_max_threads(NTHREADS + 1) >= 0);
+
+	sem = semaphore_create(0);
+	printf("stack_kb,threads,create_ns,vsz_bytes_per_thread,"
+	       "rss_bytes_per_thread\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_stack(sizes[i]);
+	}
+	semaphore_destroy(sem);
+	return 0;
+}
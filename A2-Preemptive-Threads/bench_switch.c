@@ -0,0 +1,105 @@
+#include <ucontext.h>
+#include "common.h"
+#include "context.h"
+
+/******************************************************************************
+ * Compares the raw cost of the context switch primitive used by the thread
+ * library (context_switch) against glibc's swapcontext, which the library
+ * used to switch with. Two contexts ping-pong SWITCH_LOOPS times, and we
+ * report the average cost of a single switch.
+ *
+ * This does not go through the thread library, so it does not include the
+ * scheduler or interrupt masking. bench_yield measures a full thread_yield.
+ *****************************************************************************/
+
+#define SWITCH_LOOPS 1000000
+
+static char stack[THREAD_MIN_STACK] __attribute__((aligned(16)));
+
+static ucontext_t uc_main, uc_peer;
+static struct context ctx_main, ctx_peer;
+
+static void
+peer_ucontext(void)
+{
+	while (1) {
+		swapcontext(&uc_peer, &uc_main);
+	}
+}
+
+static void
+peer_context(void *arg0, void *arg1)
+{
+	while (1) {
+		context_switch(&ctx_peer, &ctx_main);
+	}
+}
+
+static long
+elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	struct timespec diff = timespec_sub(end, start);
+	return diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec;
+}
+
+static void
+bench_ucontext(void)
+{
+	struct timespec start, end;
+	int i;
+	int ret;
+
+	ret = getcontext(&uc_peer);
+	assert(!ret);
+	uc_peer.uc_stack.ss_sp = stack;
+	uc_peer.uc_stack.ss_size = sizeof(stack);
+	uc_peer.uc_link = NULL;
+	makecontext(&uc_peer, peer_ucontext, 0);
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(!ret);
+	for (i = 0; i < SWITCH_LOOPS; i++) {
+		swapcontext(&uc_main, &uc_peer);
+	}
+	ret = clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(!ret);
+
+	/* each loop is two switches, there and back */
+	printf("swapcontext:    %6.1f ns/switch\n",
+	       (double)elapsed_ns(&start, &end) / (2.0 * SWITCH_LOOPS));
+}
+
+static void
+bench_context(void)
+{
+	struct timespec start, end;
+	int i;
+	int ret;
+
+	context_init(&ctx_peer, stack + sizeof(stack), peer_context, NULL, NULL);
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(!ret);
+	for (i = 0; i < SWITCH_LOOPS; i++) {
+		context_switch(&ctx_main, &ctx_peer);
+	}
+	ret = clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(!ret);
+
+	printf("context_switch: %6.1f ns/switch\n",
+	       (double)elapsed_ns(&start, &end) / (2.0 * SWITCH_LOOPS));
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case the switch code crashes. */
+	install_fatal_handlers((void *)main);
+
+	printf("starting switch benchmark\n");
+	bench_ucontext();
+	bench_context();
+	printf("switch benchmark done\n");
+
+	return 0;
+}
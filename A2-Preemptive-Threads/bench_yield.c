@@ -0,0 +1,84 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures the cost of thread_yield(THREAD_ANY) as the number of runnable
+ * threads grows. Every thread yields YIELD_LOOPS times in a round-robin, so
+ * each yield switches to the thread at the head of the ready queue. With an
+ * O(1) ready queue the cost per yield should stay flat from 2 to
+ * THREAD_MAX_THREADS threads.
+ *
+ * Timer interrupts are not enabled, so the numbers only include the cost of
+ * the scheduler and the context switch.
+ *****************************************************************************/
+
+#define YIELD_LOOPS 200
+
+static void
+bench_yield_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < YIELD_LOOPS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+}
+
+static void
+bench_yield(int nthreads)
+{
+	static Tid child[THREAD_MAX_THREADS];
+	struct timespec start, end, diff;
+	long nsecs;
+	long nyields;
+	int i;
+	int ret;
+
+	/* the initial thread takes part in the round-robin too */
+	for (i = 0; i < nthreads - 1; i++) {
+		child[i] = thread_create(bench_yield_thread, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(!ret);
+	for (i = 0; i < YIELD_LOOPS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	ret = clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(!ret);
+
+	for (i = 0; i < nthreads - 1; i++) {
+		ret = thread_wait(child[i], NULL);
+		assert(ret == child[i]);
+	}
+
+	diff = timespec_sub(&end, &start);
+	nsecs = diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec;
+	nyields = (long)nthreads * YIELD_LOOPS;
+	unintr_printf("%5d threads: %8ld yields, %6ld ns/yield\n",
+		      nthreads, nyields, nsecs / nyields);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting yield benchmark\n");
+	for (n = 2; n <= THREAD_MAX_THREADS; n *= 2) {
+		bench_yield(n);
+	}
+	unintr_printf("yield benchmark done\n");
+
+	return 0;
+}
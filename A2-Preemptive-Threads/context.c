@@ -0,0 +1,81 @@
+#include <assert.h>
+#include "context.h"
+
+/* Default x87 control word and MXCSR, as set up by the kernel for a new
+ * process: all exceptions masked, round to nearest. */
+#define FPU_CW_DEFAULT	0x037f
+#define MXCSR_DEFAULT	0x1f80
+
+/* Entry point of a new context. context_init leaves the function to call in
+ * r14 and its arguments in r12 and r13, and the first switch "returns" here
+ * with a 16-byte aligned stack.
+ */
+void context_start(void);
+
+/*
+ * Stack layout of a suspended context, from the saved stack pointer up:
+ *
+ *	 0: x87 control word
+ *	 8: MXCSR
+ *	16: r15, r14, r13, r12, rbx, rbp
+ *	64: return address
+ */
+__asm__(
+	"	.text\n"
+	"	.globl	context_switch\n"
+	"	.type	context_switch, @function\n"
+	"context_switch:\n"
+	"	pushq	%rbp\n"
+	"	pushq	%rbx\n"
+	"	pushq	%r12\n"
+	"	pushq	%r13\n"
+	"	pushq	%r14\n"
+	"	pushq	%r15\n"
+	"	subq	$16, %rsp\n"
+	"	stmxcsr	8(%rsp)\n"
+	"	fnstcw	(%rsp)\n"
+	"	movq	%rsp, (%rdi)\n"
+	"	movq	(%rsi), %rsp\n"
+	"	fldcw	(%rsp)\n"
+	"	ldmxcsr	8(%rsp)\n"
+	"	addq	$16, %rsp\n"
+	"	popq	%r15\n"
+	"	popq	%r14\n"
+	"	popq	%r13\n"
+	"	popq	%r12\n"
+	"	popq	%rbx\n"
+	"	popq	%rbp\n"
+	"	ret\n"
+	"	.size	context_switch, .-context_switch\n"
+	"\n"
+	"	.globl	context_start\n"
+	"	.type	context_start, @function\n"
+	"context_start:\n"
+	"	movq	%r12, %rdi\n"
+	"	movq	%r13, %rsi\n"
+	"	callq	*%r14\n"
+	"	ud2\n"
+	"	.size	context_start, .-context_start\n"
+);
+
+void
+context_init(struct context *ctx, void *stack_top,
+	     void (*fn)(void *, void *), void *arg0, void *arg1)
+{
+	/* the return address sits just below a 16-byte aligned top, so that
+	 * context_start runs with an aligned stack and fn sees the usual
+	 * (rsp + 8) alignment at its entry */
+	unsigned long *sp = (unsigned long *)((unsigned long)stack_top & ~15UL);
+
+	*--sp = (unsigned long)context_start;	/* return address */
+	*--sp = 0;				/* rbp */
+	*--sp = 0;				/* rbx */
+	*--sp = (unsigned long)arg0;		/* r12 */
+	*--sp = (unsigned long)arg1;		/* r13 */
+	*--sp = (unsigned long)fn;		/* r14 */
+	*--sp = 0;				/* r15 */
+	*--sp = MXCSR_DEFAULT;
+	*--sp = FPU_CW_DEFAULT;
+	assert(((unsigned long)sp & 15) == 8);
+	ctx->rsp = (unsigned long)sp;
+}
@@ -0,0 +1,35 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+/*
+ * A minimal x86-64 context switch, used by the thread library instead of
+ * getcontext/setcontext.
+ *
+ * A switch is an ordinary function call, so the compiler has already saved
+ * every caller-saved register at the call site. context_switch only has to
+ * push the callee-saved registers (rbx, rbp, r12-r15) and the x87 / SSE
+ * control words onto the current stack, save the stack pointer, and pop the
+ * same state off the target stack. Unlike swapcontext it does not make a
+ * sigprocmask system call and does not save the full floating point state.
+ *
+ * The signal mask is not part of the context: the caller is responsible for
+ * the signal state being the same on both sides of a switch (the thread
+ * library only switches with interrupts disabled).
+ */
+
+struct context {
+	unsigned long rsp; /* saved stack pointer, state is on the stack */
+};
+
+/* Prepare ctx so that the first switch to it calls fn(arg0, arg1) on the
+ * stack whose highest address is stack_top. fn must never return.
+ */
+void context_init(struct context *ctx, void *stack_top,
+		  void (*fn)(void *, void *), void *arg0, void *arg1);
+
+/* Save the current state into from and resume the state saved in to. Returns
+ * when some other thread switches back to from.
+ */
+void context_switch(struct context *from, struct context *to);
+
+#endif /* _CONTEXT_H_ */
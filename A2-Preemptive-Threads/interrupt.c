@@ -4,6 +4,7 @@
 #include <ucontext.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sched.h>
 #include "common.h"
 #include "interrupt.h"
 
@@ -17,13 +18,44 @@ static void interrupt_handler(int sig, siginfo_t * sip, void *contextVP);
  */
 static void set_interrupt();
 
-/* This function initializes signal set pointed to by setp so that only the 
- * signal used for the timer is included in the set.
- */
-static void set_signal(sigset_t * setp);
+static void create_timer(pid_t tid);
 
 static bool loud = false; /* print info from interrupt handler? */ 
 
+/* Periodic timers that deliver SIG_TYPE. With a single worker there is one
+ * process-wide timer. In multi-worker (M:N) mode each worker kernel thread
+ * has its own timer, directed at that thread with SIGEV_THREAD_ID. */
+static timer_t timers[THREAD_MAX_WORKERS];
+static pid_t worker_tids[THREAD_MAX_WORKERS];
+static int num_timers = 0;
+static int num_worker_tids = 0;
+static bool timer_armed = false;	/* has register_interrupt_handler run? */
+static unsigned long interval = SIG_INTERVAL;	/* usecs between interrupts */
+
+/* Interrupts are disabled in software rather than by blocking SIG_TYPE with
+ * sigprocmask, so entering and leaving a critical section costs no system
+ * calls. When a timer signal arrives while interrupts are disabled, the
+ * handler only records that an interrupt is pending, and the interrupt is
+ * delivered (i.e., the thread yields) when interrupts are re-enabled.
+ *
+ * The flags belong to the kernel thread (worker), not to the user-level
+ * thread. A thread that is preempted always resumes on the same worker (see
+ * thread_preempt), so a handler may keep using the flags of the worker it
+ * was entered on.
+ */
+static __thread volatile bool interrupts_disabled = false;
+static __thread volatile bool interrupt_pending = false;
+
+/* In M:N mode, disabling interrupts also takes the scheduler lock, so that
+ * only one worker at a time is inside the thread library. The lock is held
+ * by the worker, and is handed over with the CPU when a worker switches
+ * threads with interrupts disabled. The flag is always set before the lock
+ * is taken and cleared after it is released, so the handler never spins on
+ * a lock that its own worker holds.
+ */
+static bool smp = false;
+static volatile int sched_lock = 0;
+
 /* Test programs will call this function after initializing the threads package.
  * Many of the calls won't make sense at first -- study the man pages! 
  */
@@ -55,8 +87,14 @@ register_interrupt_handler(bool verbose)
 	error = sigemptyset(&action.sa_mask);
 	assert(!error);
 
-	/* Use sa_sigaction field as handler instead of sa_handler field. */
-	action.sa_flags = SA_SIGINFO;
+	/* Use sa_sigaction field as handler instead of sa_handler field.
+	 * SA_NODEFER keeps the kernel from blocking SIG_TYPE while the handler
+	 * runs: the handler usually switches to another thread instead of
+	 * returning, and that thread would otherwise run with SIG_TYPE blocked
+	 * in the kernel. Recursive interrupts are prevented by the software
+	 * interrupt flag instead.
+	 */
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
 
 	/* Install the signal handler. */
 	if (sigaction(SIG_TYPE, &action, NULL)) {
@@ -64,10 +102,105 @@ register_interrupt_handler(bool verbose)
 		assert(0);
 	}
 
-	/* Initialize the timer. */
+	/* Initialize the timers. */
+	if (num_worker_tids == 0) {
+		create_timer(0);
+	}
+	for (int i = 0; i < num_worker_tids; i++) {
+		create_timer(worker_tids[i]);
+	}
+	timer_armed = true;
 	set_interrupt();
 }
 
+/* Creates a timer that sends SIG_TYPE to kernel thread tid, or to the
+ * process if tid is 0. */
+static void
+create_timer(pid_t tid)
+{
+	struct sigevent sev;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_signo = SIG_TYPE;
+	if (tid == 0) {
+		sev.sigev_notify = SIGEV_SIGNAL;
+	} else {
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev._sigev_un._tid = tid;
+	}
+	if (timer_create(CLOCK_MONOTONIC, &sev, &timers[num_timers])) {
+		perror("Creating interrupt timer");
+		assert(0);
+	}
+	num_timers++;
+}
+
+/* Switches to multi-worker mode, where disabling interrupts also takes the
+ * scheduler lock. Called once by thread_init_workers, before it starts any
+ * other worker. */
+void
+interrupts_enable_smp()
+{
+	assert(!smp && interrupts_enabled());
+	smp = true;
+}
+
+/* Delivers timer interrupts to worker kernel thread tid. In M:N mode every
+ * worker must be added, before or after register_interrupt_handler. */
+void
+interrupts_add_worker(pid_t tid)
+{
+	assert(num_worker_tids < THREAD_MAX_WORKERS);
+	worker_tids[num_worker_tids++] = tid;
+	if (timer_armed) {
+		create_timer(tid);
+		set_interrupt();
+	}
+}
+
+/* Takes and releases the scheduler lock without changing the interrupt
+ * state. Idle workers release the lock while they wait for work, with
+ * interrupts still disabled. */
+void
+interrupts_lock()
+{
+	int spins = 0;
+
+	while (__atomic_exchange_n(&sched_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (sched_lock) {
+			/* the holder may have been descheduled by the kernel */
+			if (++spins % 128 == 0) {
+				sched_yield();
+			} else {
+				__builtin_ia32_pause();
+			}
+		}
+	}
+}
+
+void
+interrupts_unlock()
+{
+	__atomic_store_n(&sched_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Sets the interval between timer interrupts to usecs microseconds. This can
+ * be called before or after register_interrupt_handler. Returns the previous
+ * interval.
+ */
+unsigned long
+interrupts_set_interval(unsigned long usecs)
+{
+	unsigned long old = interval;
+
+	assert(usecs > 0);
+	interval = usecs;
+	if (timer_armed) {
+		set_interrupt();
+	}
+	return old;
+}
+
 /* Enables interrupts. */
 bool
 interrupts_on()
@@ -83,36 +216,57 @@ interrupts_off()
 }
 
 /* Enables or disables interrupts, and returns whether interrupts were enabled
- * or not previously. 
+ * or not previously. The exchange is a single instruction, so it is atomic
+ * with respect to the interrupt handler.
  */
 bool
 interrupts_set(bool enable)
 {
-	int ret;
-	sigset_t mask, omask;
+	bool was_disabled;
 
-	set_signal(&mask);
-	
-	if (enable) {
-		ret = sigprocmask(SIG_UNBLOCK, &mask, &omask);
-	} else {
-		ret = sigprocmask(SIG_BLOCK, &mask, &omask);
+	if (!enable) {
+		was_disabled = __atomic_exchange_n(&interrupts_disabled, true,
+						   __ATOMIC_SEQ_CST);
+		if (smp && !was_disabled) {
+			interrupts_lock();
+		}
+		return !was_disabled;
+	}
+
+	/* The handler does not change the flag while it is set, so reading
+	 * it and then clearing it cannot race with an interrupt. */
+	was_disabled = interrupts_disabled;
+	if (was_disabled) {
+		if (smp) {
+			interrupts_unlock();
+		}
+		__atomic_store_n(&interrupts_disabled, false, __ATOMIC_SEQ_CST);
 	}
-	assert(!ret);
 
-	return (sigismember(&omask, SIG_TYPE) ? false : true);
+	/* Deliver an interrupt that arrived while interrupts were disabled. */
+	while (interrupt_pending) {
+		if (__atomic_exchange_n(&interrupts_disabled, true,
+					__ATOMIC_SEQ_CST)) {
+			break;
+		}
+		if (smp) {
+			interrupts_lock();
+		}
+		interrupt_pending = false;
+		thread_preempt();
+		if (smp) {
+			interrupts_unlock();
+		}
+		__atomic_store_n(&interrupts_disabled, false, __ATOMIC_SEQ_CST);
+	}
+	return !was_disabled;
 }
 
 /* Returns whether interrupts are currently enabled or not. */
 bool
 interrupts_enabled()
 {
-	sigset_t mask;
-	int ret;
-
-	ret = sigprocmask(0, NULL, &mask);
-	assert(!ret);
-	return (sigismember(&mask, SIG_TYPE) ? false : true);
+	return !interrupts_disabled;
 }
 
 /* Disables output from interrupt handler function. */
@@ -148,20 +302,6 @@ unintr_printf(const char *fmt, ...)
 
 /* static functions */
 
-/* This function initializes signal set pointed to by setp so that only the 
- * signal used for the timer is included in the set.
- */
-static void
-set_signal(sigset_t * setp)
-{
-	int ret;
-	ret = sigemptyset(setp);
-	assert(!ret);
-	ret = sigaddset(setp, SIG_TYPE);
-	assert(!ret);
-	return;
-}
-
 static bool first = true;
 static struct timespec start, end, diff = { 0, 0 };
 
@@ -174,10 +314,17 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 {
 	ucontext_t *context = (ucontext_t *) contextVP;
 
-	/* Check that SIG_TYPE is blocked on entry. 
-	 * This signal should be blocked because of the default signal 
-	 * handling behavior. */
-	assert(!interrupts_enabled());
+	/* Disable interrupts, as the kernel would by blocking SIG_TYPE. If
+	 * they were already disabled, we interrupted a critical section:
+	 * defer the interrupt until interrupts are re-enabled. */
+	if (__atomic_exchange_n(&interrupts_disabled, true, __ATOMIC_SEQ_CST)) {
+		interrupt_pending = true;
+		return;
+	}
+	if (smp) {
+		interrupts_lock();
+	}
+	interrupt_pending = false;
 
 	if (loud) {
 		int ret;
@@ -205,16 +352,18 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 		write(0, msgbuf, strlen(msgbuf));
 	}
 
-	/* Re-arm the timer to deliver the next interrupt */
-	set_interrupt();
-	
-	/* Implement preemptive threading by calling thread_yield. */
-	thread_yield(THREAD_ANY);
+	/* Implement preemptive threading by calling thread_preempt, which
+	 * charges the quantum to the running thread and yields. */
+	thread_preempt();
+	interrupts_set(true);
 }
 
 /*
- * Use the setitimer() system call to set an alarm in the future. At that time,
- * this process will receive a SIGALRM signal.
+ * Program the periodic timers to send this process a SIG_TYPE signal every
+ * 'interval' microseconds. The timer re-arms itself in the kernel, so the
+ * interrupt handler does not need a system call per tick, and the ticks do
+ * not drift by the time it takes to run the handler. CLOCK_MONOTONIC is not
+ * affected by changes to the wall-clock time.
  *
  * In interrupt.h, we #define SIG_TYPE to the signal generated by the timer. 
  * Different timers may generate different signals, so using SIG_TYPE lets us
@@ -225,17 +374,14 @@ static void
 set_interrupt()
 {
 	int ret;
-	struct itimerval val;
+	struct itimerspec val;
 
-	/* QUESTION: Will the timer automatically fire every SIG_INTERVAL
-	 * microseconds or not? (HINT: Read the man page for setitimer.)
-	 */
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = 0;
-
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = SIG_INTERVAL;
+	val.it_interval.tv_sec = interval / USEC_PER_SEC;
+	val.it_interval.tv_nsec = (interval % USEC_PER_SEC) * 1000;
+	val.it_value = val.it_interval;
 
-	ret = setitimer(ITIMER_REAL, &val, NULL);
-	assert(!ret);
+	for (int i = 0; i < num_timers; i++) {
+		ret = timer_settime(timers[i], 0, &val, NULL);
+		assert(!ret);
+	}
 }
@@ -7,10 +7,11 @@
 
 /* we will use this signal type for delivering "interrupts". */
 #define SIG_TYPE SIGALRM
-/* the interrupt will be delivered every 200 usec */
+/* by default, the interrupt will be delivered every 200 usec */
 #define SIG_INTERVAL 200
 
 void register_interrupt_handler(bool verbose);
+unsigned long interrupts_set_interval(unsigned long usecs);
 bool interrupts_on(void);
 bool interrupts_off(void);
 bool interrupts_set(bool enable);
@@ -18,6 +19,12 @@ bool interrupts_enabled();
 void interrupts_quiet();
 void interrupts_loud();
 
+/* multi-worker (M:N) support, used by thread_init_workers */
+void interrupts_enable_smp(void);
+void interrupts_add_worker(pid_t tid);
+void interrupts_lock(void);
+void interrupts_unlock(void);
+
 /* turn off interrupts while printing */
 int unintr_printf(const char *fmt, ...);
 #endif
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests channels:
+ *
+ * - A send to a waiting receiver hands the message over, even on a channel
+ *   without a buffer, and the sender keeps running.
+ * - A send on a channel without a buffer and no receiver waits until it is
+ *   received.
+ * - A message handed to a receiver that is killed before it runs goes to
+ *   the next receiver, or back to the front of the buffer (with a single
+ *   worker, so that the receiver cannot run before it is killed).
+ * - Closing a channel fails waiting senders and receivers, and later sends,
+ *   while the messages already buffered can still be received.
+ * - NPRODUCERS producers and NCONSUMERS consumers pass NMSGS messages each
+ *   through a small buffer, with timer interrupts on. Every message is
+ *   received once, and each consumer gets each producer's messages in the
+ *   order they were sent.
+ *****************************************************************************/
+
+#define BUFSIZE 4
+#define NPRODUCERS 4
+#define NCONSUMERS 4
+#define NMSGS 5000		/* per producer */
+
+static struct chan *ch;
+static volatile int received;
+static volatile int sent;
+/* with more workers, another one may run a receiver as soon as it is handed
+ * a message */
+static bool one_worker;
+
+static void
+test_chan_receiver(void *arg)
+{
+	void *msg;
+
+	assert(chan_recv(ch, &msg) == 1);
+	assert(msg == (void *)0x1234);
+	received = 1;
+}
+
+static void
+test_chan_sender(void *arg)
+{
+	assert(chan_send(ch, arg) == 1);
+	sent = 1;
+}
+
+static void
+test_chan_handoff(void)
+{
+	Tid child;
+	void *msg;
+
+	/* to a waiting receiver */
+	ch = chan_create(0);
+	child = thread_create(test_chan_receiver, NULL);
+	assert(thread_ret_ok(child));
+	thread_yield(child);
+	assert(chan_send(ch, (void *)0x1234) == 1);
+	if (one_worker) {
+		assert(!received);
+	}
+	thread_wait(child, NULL);
+	assert(received);
+	chan_destroy(ch);
+
+	/* from a waiting sender, without a buffer */
+	ch = chan_create(0);
+	child = thread_create(test_chan_sender, (void *)0x5678);
+	assert(thread_ret_ok(child));
+	thread_yield(child);
+	thread_yield(THREAD_ANY);
+	assert(!sent);
+	assert(chan_recv(ch, &msg) == 1);
+	assert(msg == (void *)0x5678);
+	thread_wait(child, NULL);
+	assert(sent);
+	chan_destroy(ch);
+	unintr_printf("handoff ok\n");
+}
+
+static void
+test_chan_victim(void *arg)
+{
+	void *msg;
+
+	chan_recv(ch, &msg);
+	assert(0);
+}
+
+static void
+test_chan_kill(void)
+{
+	Tid child[2];
+	void *msg;
+
+	/* to the next receiver */
+	ch = chan_create(1);
+	received = 0;
+	child[0] = thread_create(test_chan_victim, NULL);
+	child[1] = thread_create(test_chan_receiver, NULL);
+	assert(thread_ret_ok(child[0]) && thread_ret_ok(child[1]));
+	thread_yield(child[0]);
+	thread_yield(child[1]);
+	assert(chan_send(ch, (void *)0x1234) == 1);
+	assert(thread_kill(child[0]) == child[0]);
+	thread_wait(child[1], NULL);
+	assert(received);
+	chan_destroy(ch);
+
+	/* back to the buffer, which is full by then */
+	ch = chan_create(1);
+	child[0] = thread_create(test_chan_victim, NULL);
+	assert(thread_ret_ok(child[0]));
+	thread_yield(child[0]);
+	assert(chan_send(ch, (void *)1) == 1);
+	assert(chan_send(ch, (void *)2) == 1);
+	assert(thread_kill(child[0]) == child[0]);
+	/* it exits the next time it runs */
+	thread_yield(THREAD_ANY);
+	assert(chan_recv(ch, &msg) == 1 && msg == (void *)1);
+	assert(chan_recv(ch, &msg) == 1 && msg == (void *)2);
+	chan_destroy(ch);
+	unintr_printf("kill ok\n");
+}
+
+static void
+test_chan_closed_receiver(void *arg)
+{
+	void *msg;
+
+	assert(chan_recv(ch, &msg) == 0);
+}
+
+static void
+test_chan_closed_sender(void *arg)
+{
+	assert(chan_send(ch, arg) == 0);
+}
+
+static void
+test_chan_close(void)
+{
+	Tid child[2];
+	void *msg;
+	long i;
+
+	/* waiting receivers */
+	ch = chan_create(BUFSIZE);
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_chan_closed_receiver, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	thread_yield(THREAD_ANY);
+	chan_close(ch);
+	for (i = 0; i < 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+	assert(chan_send(ch, NULL) == 0);
+	chan_destroy(ch);
+
+	/* buffered messages and a waiting sender */
+	ch = chan_create(BUFSIZE);
+	for (i = 0; i < BUFSIZE; i++) {
+		assert(chan_send(ch, (void *)i) == 1);
+	}
+	child[0] = thread_create(test_chan_closed_sender, (void *)i);
+	assert(thread_ret_ok(child[0]));
+	thread_yield(child[0]);
+	chan_close(ch);
+	thread_wait(child[0], NULL);
+	for (i = 0; i < BUFSIZE; i++) {
+		assert(chan_recv(ch, &msg) == 1);
+		assert(msg == (void *)i);
+	}
+	assert(chan_recv(ch, &msg) == 0);
+	chan_destroy(ch);
+	unintr_printf("close ok\n");
+}
+
+static long consumed_sum;
+static int nconsumed;
+
+static void
+test_chan_producer(void *arg)
+{
+	long p = (long)arg;
+	long i;
+
+	for (i = 0; i < NMSGS; i++) {
+		assert(chan_send(ch, (void *)(p * NMSGS + i + 1)) == 1);
+	}
+}
+
+static void
+test_chan_consumer(void *arg)
+{
+	long last[NPRODUCERS];
+	long sum = 0, m;
+	int n = 0;
+	void *msg;
+	int i;
+
+	for (i = 0; i < NPRODUCERS; i++) {
+		last[i] = -1;
+	}
+	while (chan_recv(ch, &msg)) {
+		m = (long)msg - 1;
+		assert(m % NMSGS > last[m / NMSGS]);
+		last[m / NMSGS] = m % NMSGS;
+		sum += m;
+		n++;
+	}
+	__atomic_add_fetch(&consumed_sum, sum, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&nconsumed, n, __ATOMIC_RELAXED);
+}
+
+static void
+test_chan_mpmc(void)
+{
+	Tid child[NPRODUCERS + NCONSUMERS];
+	long n = (long)NPRODUCERS * NMSGS;
+	long i;
+
+	ch = chan_create(BUFSIZE);
+	for (i = 0; i < NPRODUCERS; i++) {
+		child[i] = thread_create(test_chan_producer, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCONSUMERS; i++) {
+		child[NPRODUCERS + i] = thread_create(test_chan_consumer, NULL);
+		assert(thread_ret_ok(child[NPRODUCERS + i]));
+	}
+	for (i = 0; i < NPRODUCERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	chan_close(ch);
+	for (i = NPRODUCERS; i < NPRODUCERS + NCONSUMERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("consumed %d messages\n", nconsumed);
+	assert(nconsumed == n);
+	assert(consumed_sum == n * (n - 1) / 2);
+	chan_destroy(ch);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting channel test\n");
+	one_worker = getenv("THREAD_WORKERS") == NULL;
+	test_chan_handoff();
+	if (one_worker) {
+		test_chan_kill();
+	}
+	test_chan_close();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_chan_mpmc();
+	unintr_printf("channel test done\n");
+	return 0;
+}
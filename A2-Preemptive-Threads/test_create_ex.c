@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests thread_create_ex:
+ *
+ * - Stack sizes out of range and priorities out of range are rejected.
+ * - A thread's name is copied, truncated to THREAD_NAME_LEN - 1 characters,
+ *   and thread_stats returns it. The initial thread is "main", and a thread
+ *   made without a name has none.
+ * - A thread created at a higher priority runs before one created at a
+ *   lower priority (with a single worker, so that neither runs before we
+ *   yield).
+ * - A thread with a DEEP_STACK byte stack recurses through more than half
+ *   of it, far more than THREAD_MIN_STACK.
+ * - NSMALL threads with THREAD_STACK_FLOOR byte stacks spin with timer
+ *   interrupts on, so that the signal handler runs on their stacks.
+ * - NIDLE threads with IDLE_STACK byte stacks, all sleeping on a semaphore
+ *   at once, fit in BYTES_PER_THREAD bytes of resident memory each, and
+ *   their stacks are unmapped once they are reaped.
+ *****************************************************************************/
+
+#define DEEP_STACK (8 << 20)
+#define FRAME_BYTES 1024
+#define NSMALL 1000
+#define SPIN_USECS 1000
+#define NIDLE 256
+#define IDLE_STACK (4 << 20)
+#define BYTES_PER_THREAD 65536
+
+static int order[2];
+static int norder;
+
+static void
+test_attr_record(void *arg)
+{
+	order[norder++] = (long)arg;
+}
+
+static void
+test_attr_invalid(void)
+{
+	struct thread_attr attr;
+
+	thread_attr_init(&attr);
+	assert(attr.stack_size == THREAD_MIN_STACK);
+	assert(attr.prio == THREAD_PRIO_DEFAULT && attr.name == NULL);
+	attr.stack_size = THREAD_STACK_FLOOR - 1;
+	assert(thread_create_ex(test_attr_record, NULL, &attr) ==
+	       THREAD_INVALID);
+	attr.stack_size = THREAD_MAX_STACK + 1;
+	assert(thread_create_ex(test_attr_record, NULL, &attr) ==
+	       THREAD_INVALID);
+	thread_attr_init(&attr);
+	attr.prio = THREAD_PRIO_LOWEST + 1;
+	assert(thread_create_ex(test_attr_record, NULL, &attr) ==
+	       THREAD_INVALID);
+	attr.prio = THREAD_PRIO_HIGHEST - 1;
+	assert(thread_create_ex(test_attr_record, NULL, &attr) ==
+	       THREAD_INVALID);
+}
+
+static void
+test_attr_names(void)
+{
+	struct thread_stats stats;
+	struct thread_attr attr;
+	char name[64];
+	Tid child;
+
+	assert(thread_stats(0, &stats) == 0);
+	assert(strcmp(stats.name, "main") == 0);
+
+	memset(name, 'x', sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+	thread_attr_init(&attr);
+	attr.name = name;
+	child = thread_create_ex(test_attr_record, (void *)0, &attr);
+	assert(thread_ret_ok(child));
+	/* the name was copied */
+	name[0] = 'y';
+	assert(thread_stats(child, &stats) == child);
+	assert(strlen(stats.name) == THREAD_NAME_LEN - 1);
+	assert(strspn(stats.name, "x") == THREAD_NAME_LEN - 1);
+	thread_wait(child, NULL);
+
+	child = thread_create_ex(test_attr_record, (void *)0, NULL);
+	assert(thread_ret_ok(child));
+	assert(thread_stats(child, &stats) == child);
+	assert(stats.name[0] == '\0');
+	thread_wait(child, NULL);
+}
+
+static void
+test_attr_prio(void)
+{
+	struct thread_attr attr;
+	Tid child[2];
+
+	norder = 0;
+	thread_attr_init(&attr);
+	attr.prio = THREAD_PRIO_LOWEST;
+	child[0] = thread_create_ex(test_attr_record, (void *)0, &attr);
+	attr.prio = THREAD_PRIO_HIGHEST;
+	child[1] = thread_create_ex(test_attr_record, (void *)1, &attr);
+	assert(thread_ret_ok(child[0]) && thread_ret_ok(child[1]));
+	thread_wait(child[0], NULL);
+	thread_wait(child[1], NULL);
+	assert(norder == 2 && order[0] == 1 && order[1] == 0);
+}
+
+/* Recurses through n frames of FRAME_BYTES each, and returns how many of
+ * them were intact on the way back up. */
+static long
+recurse(int n)
+{
+	volatile char frame[FRAME_BYTES];
+
+	if (n == 0) {
+		return 0;
+	}
+	frame[0] = (char)n;
+	frame[FRAME_BYTES - 1] = (char)n;
+	return recurse(n - 1) +
+	    (frame[0] == (char)n && frame[FRAME_BYTES - 1] == (char)n);
+}
+
+static void
+test_attr_deep_thread(void *arg)
+{
+	long depth = (long)arg;
+
+	thread_exit(recurse(depth) == depth);
+}
+
+static void
+test_attr_deep(void)
+{
+	struct thread_attr attr;
+	int exit_code;
+	Tid child;
+
+	thread_attr_init(&attr);
+	attr.stack_size = DEEP_STACK;
+	attr.name = "deep";
+	child = thread_create_ex(test_attr_deep_thread,
+				 (void *)(long)(DEEP_STACK / 2 / FRAME_BYTES),
+				 &attr);
+	assert(thread_ret_ok(child));
+	thread_wait(child, &exit_code);
+	assert(exit_code == 1);
+	unintr_printf("recursed through %d KB\n", DEEP_STACK / 2 / 1024);
+}
+
+static int nspun;
+
+static void
+test_attr_small_thread(void *arg)
+{
+	spin(SPIN_USECS);
+	__atomic_add_fetch(&nspun, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_attr_small(void)
+{
+	static Tid child[NSMALL];
+	struct thread_attr attr;
+	int i;
+
+	thread_attr_init(&attr);
+	attr.stack_size = THREAD_STACK_FLOOR;
+	for (i = 0; i < NSMALL; i++) {
+		child[i] = thread_create_ex(test_attr_small_thread, NULL, &attr);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NSMALL; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("%d threads spun on small stacks\n", nspun);
+	assert(nspun == NSMALL);
+}
+
+static struct semaphore *sem;
+
+static void
+test_attr_idle_thread(void *arg)
+{
+	semaphore_down(sem);
+}
+
+/* Reads the size and the resident set size of the process, in bytes. */
+static void
+process_bytes(long *size, long *resident)
+{
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	assert(f != NULL);
+	assert(fscanf(f, "%ld %ld", size, resident) == 2);
+	fclose(f);
+	*size *= sysconf(_SC_PAGESIZE);
+	*resident *= sysconf(_SC_PAGESIZE);
+}
+
+static void
+test_attr_idle(void)
+{
+	static Tid child[NIDLE];
+	long size[3], resident[3];
+	struct thread_attr attr;
+	int i;
+
+	sem = semaphore_create(0);
+	thread_attr_init(&attr);
+	attr.stack_size = IDLE_STACK;
+	attr.name = "idle";
+	process_bytes(&size[0], &resident[0]);
+	for (i = 0; i < NIDLE; i++) {
+		child[i] = thread_create_ex(test_attr_idle_thread, NULL, &attr);
+		assert(thread_ret_ok(child[i]));
+	}
+	/* let them all run and go to sleep */
+	for (i = 0; i < NIDLE; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	process_bytes(&size[1], &resident[1]);
+	for (i = 0; i < NIDLE; i++) {
+		semaphore_up(sem);
+	}
+	for (i = 0; i < NIDLE; i++) {
+		thread_wait(child[i], NULL);
+	}
+	process_bytes(&size[2], &resident[2]);
+	unintr_printf("%d idle threads with %d KB stacks: %ld bytes resident "
+		      "each\n", NIDLE, IDLE_STACK / 1024,
+		      (resident[1] - resident[0]) / NIDLE);
+	assert(size[1] - size[0] >= (long)NIDLE * IDLE_STACK);
+	assert(resident[1] - resident[0] < (long)NIDLE * BYTES_PER_THREAD);
+	assert(size[1] - size[2] >= (long)NIDLE * IDLE_STACK);
+	semaphore_destroy(sem);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting create_ex test\n");
+	test_attr_invalid();
+	test_attr_names();
+	if (getenv("THREAD_WORKERS") == NULL) {
+		test_attr_prio();
+	}
+	test_attr_deep();
+	test_attr_idle();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_attr_small();
+	unintr_printf("create_ex test done\n");
+	return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests the fair-share scheduler:
+ *
+ * - thread_set_sched rejects unknown policies and returns the previous one,
+ *   and weights out of range are rejected by thread_set_weight and
+ *   thread_create_ex.
+ * - With timer interrupts on, NHOGS spinning threads with the weights in
+ *   hog_weights get CPU time in proportion to them, within TOLERANCE.
+ * - A thread that slept for SLEEP_USECS while a hog of the same weight ran
+ *   is not owed that time: while it runs for WINDOW_USECS once it wakes up,
+ *   the hog runs for more than half as long.
+ *   These two run with a single worker only, as with more workers than
+ *   CPUs each worker only gets its share of the CPU, whatever the weights.
+ * - Switching back to THREAD_SCHED_MLFQ while threads are ready, and to
+ *   THREAD_SCHED_FAIR again, leaves every one of them runnable.
+ *****************************************************************************/
+
+#define NHOGS 3
+#define RUN_USECS 1000000
+#define TOLERANCE 0.2
+#define SLEEP_USECS 500000
+#define WINDOW_USECS 200000
+#define NSWITCHERS 16
+#define NROUNDS 100
+
+static const int hog_weights[NHOGS] = { 1024, 2048, 4096 };
+static volatile int stop;
+
+static void
+test_fair_hog(void *arg)
+{
+	while (!stop) {
+	}
+}
+
+static void
+test_fair_api(void)
+{
+	struct thread_attr attr;
+
+	assert(thread_set_sched(-1) == THREAD_INVALID);
+	assert(thread_set_sched(THREAD_SCHED_FAIR + 1) == THREAD_INVALID);
+	assert(thread_set_sched(THREAD_SCHED_FAIR) == THREAD_SCHED_MLFQ);
+	assert(thread_set_sched(THREAD_SCHED_FAIR) == THREAD_SCHED_FAIR);
+	assert(thread_set_weight(thread_id(), 0) == THREAD_INVALID);
+	assert(thread_set_weight(thread_id(), THREAD_WEIGHT_MAX + 1) ==
+	       THREAD_INVALID);
+	assert(thread_set_weight(THREAD_MAX_THREADS - 1, THREAD_WEIGHT_DEFAULT)
+	       == THREAD_INVALID);
+	assert(thread_set_weight(thread_id(), THREAD_WEIGHT_DEFAULT) ==
+	       thread_id());
+	thread_attr_init(&attr);
+	assert(attr.weight == THREAD_WEIGHT_DEFAULT);
+	attr.weight = 0;
+	assert(thread_create_ex(test_fair_hog, NULL, &attr) == THREAD_INVALID);
+}
+
+static void
+test_fair_shares(void)
+{
+	struct thread_stats stats[NHOGS];
+	struct thread_attr attr;
+	Tid hog[NHOGS];
+	double total_cpu = 0, total_weight = 0;
+	int i;
+
+	stop = 0;
+	thread_attr_init(&attr);
+	for (i = 0; i < NHOGS; i++) {
+		attr.weight = hog_weights[i];
+		hog[i] = thread_create_ex(test_fair_hog, NULL, &attr);
+		assert(thread_ret_ok(hog[i]));
+		total_weight += hog_weights[i];
+	}
+	thread_sleep_for(RUN_USECS);
+	for (i = 0; i < NHOGS; i++) {
+		assert(thread_stats(hog[i], &stats[i]) == hog[i]);
+		total_cpu += stats[i].cpu_ns;
+	}
+	stop = 1;
+	for (i = 0; i < NHOGS; i++) {
+		double share = stats[i].cpu_ns / total_cpu;
+		double expected = hog_weights[i] / total_weight;
+
+		thread_wait(hog[i], NULL);
+		unintr_printf("weight %d: %.3f of the CPU, expected %.3f\n",
+			      hog_weights[i], share, expected);
+		assert(share > expected * (1 - TOLERANCE));
+		assert(share < expected * (1 + TOLERANCE));
+	}
+}
+
+static Tid sleep_hog;
+static long hog_us;
+
+static unsigned long
+cpu_ns(Tid tid)
+{
+	struct thread_stats stats;
+
+	assert(thread_stats(tid, &stats) == tid);
+	return stats.cpu_ns;
+}
+
+static void
+test_fair_sleeper(void *arg)
+{
+	unsigned long hog_start, start;
+
+	thread_sleep_for(SLEEP_USECS);
+	hog_start = cpu_ns(sleep_hog);
+	start = cpu_ns(thread_id());
+	while (cpu_ns(thread_id()) - start < WINDOW_USECS * 1000L) {
+	}
+	hog_us = (cpu_ns(sleep_hog) - hog_start) / 1000;
+}
+
+static void
+test_fair_sleep(void)
+{
+	Tid sleeper;
+
+	stop = 0;
+	sleep_hog = thread_create(test_fair_hog, NULL);
+	sleeper = thread_create(test_fair_sleeper, NULL);
+	assert(thread_ret_ok(sleep_hog) && thread_ret_ok(sleeper));
+	thread_wait(sleeper, NULL);
+	stop = 1;
+	thread_wait(sleep_hog, NULL);
+	unintr_printf("hog ran %ld us while the sleeper ran %d us\n", hog_us,
+		      WINDOW_USECS);
+	/* the sleeper and the hog take turns, instead of the sleeper running
+	 * until it has caught up with the hog */
+	assert(hog_us > WINDOW_USECS / 2);
+}
+
+static volatile int nrounds;
+
+static void
+test_fair_switcher(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NROUNDS; i++) {
+		spin(100);
+		thread_yield(THREAD_ANY);
+		__atomic_add_fetch(&nrounds, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+test_fair_switch(void)
+{
+	Tid child[NSWITCHERS];
+	int i;
+
+	for (i = 0; i < NSWITCHERS; i++) {
+		child[i] = thread_create(test_fair_switcher, NULL);
+		assert(thread_ret_ok(child[i]));
+		assert(thread_set_weight(child[i], 256 << (i % 4)) == child[i]);
+	}
+	thread_yield(THREAD_ANY);
+	assert(thread_set_sched(THREAD_SCHED_MLFQ) == THREAD_SCHED_FAIR);
+	thread_yield(THREAD_ANY);
+	assert(thread_set_sched(THREAD_SCHED_FAIR) == THREAD_SCHED_MLFQ);
+	for (i = 0; i < NSWITCHERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("%d rounds across policy switches\n", nrounds);
+	assert(nrounds == NSWITCHERS * NROUNDS);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting fair test\n");
+	test_fair_api();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	if (getenv("THREAD_WORKERS") == NULL) {
+		test_fair_shares();
+		test_fair_sleep();
+	}
+	test_fair_switch();
+	unintr_printf("fair test done\n");
+	return 0;
+}
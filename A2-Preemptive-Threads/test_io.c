@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests threads that block on file descriptors:
+ *
+ * - A thread reading an empty pipe sleeps while another thread keeps
+ *   running, gets what that thread writes, and then sees end of file.
+ * - A thread writes BIGWRITE bytes through a pipe, blocking whenever it is
+ *   full, while another thread reads them.
+ * - An echo server accepts NCLIENTS loopback TCP connections, with a thread
+ *   per connection, and every client thread gets its own message back.
+ * - With timer interrupts on, a thread waiting on a pipe is woken by the
+ *   periodic poll while a spinning thread never lets the ready queue drain.
+ * - Calls on bad fds fail with EBADF.
+ *****************************************************************************/
+
+#define NCOUNTS 100
+#define BIGWRITE (1 << 20)
+#define CHUNK 4096
+#define NCLIENTS 100
+#define MSGLEN 64
+#define SPIN_USECS 500000
+#define WRITE_DELAY_USECS 20000
+
+static int fds[2];
+static volatile int counter;
+static unsigned long bigsum;
+
+static void
+test_io_counter(void *arg)
+{
+	for (counter = 0; counter < NCOUNTS; counter++) {
+		thread_yield(THREAD_ANY);
+	}
+	assert(thread_write(fds[1], "hello", 5) == 5);
+	close(fds[1]);
+}
+
+static void
+test_io_pipe(void)
+{
+	char buf[16];
+	Tid child;
+
+	assert(pipe(fds) == 0);
+	child = thread_create(test_io_counter, NULL);
+	assert(thread_ret_ok(child));
+	/* the counter runs while we wait */
+	assert(thread_read(fds[0], buf, sizeof(buf)) == 5);
+	assert(counter == NCOUNTS);
+	assert(memcmp(buf, "hello", 5) == 0);
+	assert(thread_read(fds[0], buf, sizeof(buf)) == 0);
+	thread_wait(child, NULL);
+	close(fds[0]);
+	unintr_printf("pipe read waited for %d yields\n", NCOUNTS);
+}
+
+static void
+test_io_big_writer(void *arg)
+{
+	char *buf = malloc369(BIGWRITE);
+	ssize_t n;
+	long i;
+
+	assert(buf != NULL);
+	for (i = 0; i < BIGWRITE; i++) {
+		buf[i] = i * 7;
+	}
+	for (i = 0; i < BIGWRITE; i += n) {
+		n = thread_write(fds[1], buf + i, BIGWRITE - i);
+		assert(n > 0);
+	}
+	close(fds[1]);
+	free369(buf);
+}
+
+static void
+test_io_big_reader(void *arg)
+{
+	unsigned char buf[CHUNK];
+	unsigned long sum = 0;
+	long total = 0;
+	ssize_t n;
+	int i;
+
+	while ((n = thread_read(fds[0], buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			sum += (unsigned char)((total + i) * 7) == buf[i];
+		}
+		total += n;
+	}
+	assert(n == 0);
+	assert(total == BIGWRITE);
+	bigsum = sum;
+	close(fds[0]);
+}
+
+static void
+test_io_big(void)
+{
+	Tid child[2];
+	int i;
+
+	assert(pipe(fds) == 0);
+	child[0] = thread_create(test_io_big_writer, NULL);
+	child[1] = thread_create(test_io_big_reader, NULL);
+	for (i = 0; i < 2; i++) {
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("%lu of %d bytes through a pipe\n", bigsum, BIGWRITE);
+	assert(bigsum == BIGWRITE);
+}
+
+static int listen_fd;
+static struct sockaddr_in server_addr;
+static int nechoed;
+
+static void
+test_io_echo(void *arg)
+{
+	int fd = (long)arg;
+	char buf[MSGLEN];
+	ssize_t n;
+
+	while ((n = thread_read(fd, buf, sizeof(buf))) > 0) {
+		assert(thread_write(fd, buf, n) == n);
+	}
+	assert(n == 0);
+	close(fd);
+}
+
+static void
+test_io_server(void *arg)
+{
+	Tid child[NCLIENTS];
+	int fd;
+	int i;
+
+	for (i = 0; i < NCLIENTS; i++) {
+		fd = thread_accept(listen_fd, NULL, NULL);
+		assert(fd >= 0);
+		child[i] = thread_create(test_io_echo, (void *)(long)fd);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCLIENTS; i++) {
+		thread_wait(child[i], NULL);
+	}
+}
+
+static void
+test_io_client(void *arg)
+{
+	char msg[MSGLEN], buf[MSGLEN];
+	int got = 0;
+	ssize_t n;
+	int fd;
+
+	snprintf(msg, sizeof(msg), "client %ld", (long)arg);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	assert(connect(fd, (struct sockaddr *)&server_addr,
+		       sizeof(server_addr)) == 0);
+	/* let the other clients connect before the echo comes back */
+	thread_yield(THREAD_ANY);
+	assert(thread_write(fd, msg, sizeof(msg)) == sizeof(msg));
+	while (got < sizeof(buf)) {
+		n = thread_read(fd, buf + got, sizeof(buf) - got);
+		assert(n > 0);
+		got += n;
+	}
+	assert(strcmp(buf, msg) == 0);
+	close(fd);
+	__atomic_add_fetch(&nechoed, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_io_tcp(void)
+{
+	Tid server, child[NCLIENTS];
+	socklen_t len = sizeof(server_addr);
+	long i;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(listen_fd >= 0);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server_addr.sin_port = 0;
+	assert(bind(listen_fd, (struct sockaddr *)&server_addr,
+		    sizeof(server_addr)) == 0);
+	assert(getsockname(listen_fd, (struct sockaddr *)&server_addr,
+			   &len) == 0);
+	assert(listen(listen_fd, NCLIENTS) == 0);
+
+	server = thread_create(test_io_server, NULL);
+	assert(thread_ret_ok(server));
+	for (i = 0; i < NCLIENTS; i++) {
+		child[i] = thread_create(test_io_client, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCLIENTS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	thread_wait(server, NULL);
+	close(listen_fd);
+	unintr_printf("%d clients echoed\n", nechoed);
+	assert(nechoed == NCLIENTS);
+}
+
+static struct timespec start;
+static long woke_us, spun_us;
+
+static long
+elapsed_us(void)
+{
+	struct timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	diff = timespec_sub(&now, &start);
+	return diff.tv_sec * USEC_PER_SEC + diff.tv_nsec / 1000;
+}
+
+static void
+test_io_tick_reader(void *arg)
+{
+	char c;
+
+	assert(thread_read(fds[0], &c, 1) == 1);
+	woke_us = elapsed_us();
+}
+
+static void
+test_io_tick_spinner(void *arg)
+{
+	spin(SPIN_USECS);
+	spun_us = elapsed_us();
+}
+
+static void
+test_io_tick(void)
+{
+	Tid child[2];
+	pid_t pid;
+	int i;
+
+	assert(pipe(fds) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		usleep(WRITE_DELAY_USECS);
+		assert(write(fds[1], "x", 1) == 1);
+		_exit(0);
+	}
+	child[0] = thread_create(test_io_tick_reader, NULL);
+	child[1] = thread_create(test_io_tick_spinner, NULL);
+	for (i = 0; i < 2; i++) {
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+	assert(waitpid(pid, NULL, 0) == pid);
+	close(fds[0]);
+	close(fds[1]);
+	unintr_printf("reader woke up after %ld us, spinner done after %ld us\n",
+		      woke_us, spun_us);
+	assert(woke_us >= WRITE_DELAY_USECS);
+	assert(woke_us < SPIN_USECS / 2);
+}
+
+int
+main(int argc, char **argv)
+{
+	char c;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting io test\n");
+	assert(thread_read(-1, &c, 1) == -1 && errno == EBADF);
+	assert(thread_write(12345, &c, 1) == -1 && errno == EBADF);
+	test_io_pipe();
+	test_io_big();
+	test_io_tcp();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_io_tick();
+	unintr_printf("io test done\n");
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests the lock modes of lock_create_flags.
+ *
+ * With LOCK_HANDOFF, NCHILDREN threads queue up on a lock held by the
+ * initial thread, which releases it and immediately tries to take it back.
+ * The lock must go to the waiters in FIFO order, and the initial thread must
+ * get it last. Without LOCK_HANDOFF, the initial thread takes it straight
+ * back. A waiter that is killed after the lock was handed to it must pass
+ * the lock on when it exits.
+ *
+ * With LOCK_ADAPTIVE, threads increment a shared counter under the lock,
+ * with timer interrupts on, and the counter must be exact.
+ *****************************************************************************/
+
+#define NCHILDREN 8
+#define NINCREMENTS 500
+
+static struct lock *lock;
+static int order[NCHILDREN];
+static int norder;
+static long counter;
+
+static void
+test_handoff_thread(void *arg)
+{
+	lock_acquire(lock);
+	order[norder++] = (long)arg;
+	lock_release(lock);
+}
+
+/* Queues NCHILDREN threads up on a lock with the given flags, then releases
+ * and reacquires it. Returns how many of them got the lock first. */
+static int
+test_handoff(int flags)
+{
+	Tid child[NCHILDREN];
+	struct lock_stats stats;
+	int ngot;
+	long i;
+
+	lock = lock_create_flags(flags);
+	norder = 0;
+	lock_acquire(lock);
+	for (i = 0; i < NCHILDREN; i++) {
+		child[i] = thread_create(test_handoff_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	/* let every child block on the lock */
+	thread_yield(THREAD_ANY);
+	lock_get_stats(lock, &stats);
+	assert(stats.contended == NCHILDREN);
+
+	lock_release(lock);
+	lock_acquire(lock);
+	ngot = norder;
+	lock_release(lock);
+	for (i = 0; i < NCHILDREN; i++) {
+		thread_wait(child[i], NULL);
+	}
+	assert(norder == NCHILDREN);
+	for (i = 0; i < NCHILDREN; i++) {
+		assert(order[i] == i);
+	}
+
+	lock_get_stats(lock, &stats);
+	unintr_printf("flags %d: %d waiters ran first, %lu acquires, %lu "
+		      "contended, %lu handoffs\n", flags, ngot, stats.acquires,
+		      stats.contended, stats.handoffs);
+	lock_destroy(lock);
+	return ngot;
+}
+
+/* A waiter is handed the lock and killed before it runs. */
+static void
+test_handoff_kill(void)
+{
+	Tid child[2];
+	struct lock_stats stats;
+	long i;
+
+	lock = lock_create_flags(LOCK_HANDOFF);
+	norder = 0;
+	lock_acquire(lock);
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_handoff_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	thread_yield(THREAD_ANY);
+	/* the lock goes to child 0, which is killed before it can take it */
+	lock_release(lock);
+	assert(thread_kill(child[0]) == child[0]);
+	lock_acquire(lock);
+	assert(norder == 1 && order[0] == 1);
+	lock_release(lock);
+
+	/* a killed thread cannot be waited for */
+	assert(thread_wait(child[0], NULL) == THREAD_INVALID);
+	thread_wait(child[1], NULL);
+	lock_get_stats(lock, &stats);
+	assert(stats.handoffs == 3);
+	lock_destroy(lock);
+}
+
+static void
+test_adaptive_thread(void *arg)
+{
+	long old;
+	int i;
+
+	for (i = 0; i < NINCREMENTS; i++) {
+		lock_acquire(lock);
+		old = counter;
+		spin(10);
+		counter = old + 1;
+		lock_release(lock);
+	}
+}
+
+static void
+test_adaptive(int flags)
+{
+	Tid child[NCHILDREN];
+	struct lock_stats stats;
+	int i;
+
+	lock = lock_create_flags(flags);
+	counter = 0;
+	for (i = 0; i < NCHILDREN; i++) {
+		child[i] = thread_create(test_adaptive_thread, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCHILDREN; i++) {
+		thread_wait(child[i], NULL);
+	}
+	lock_get_stats(lock, &stats);
+	unintr_printf("flags %d: %lu acquires, %lu contended, %lu yields, "
+		      "%lu handoffs\n", flags, stats.acquires, stats.contended,
+		      stats.yields, stats.handoffs);
+	assert(counter == NCHILDREN * NINCREMENTS);
+	assert(stats.acquires == NCHILDREN * NINCREMENTS);
+	lock_destroy(lock);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting lock handoff test\n");
+	if (test_handoff(0) != 0) {
+		unintr_printf("lock handoff test failed: a waiter ran before "
+			      "the releasing thread reacquired the lock\n");
+		return 1;
+	}
+	if (test_handoff(LOCK_HANDOFF) != NCHILDREN) {
+		unintr_printf("lock handoff test failed: the releasing thread "
+			      "took the lock back from its waiters\n");
+		return 1;
+	}
+	test_handoff_kill();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_adaptive(LOCK_ADAPTIVE);
+	test_adaptive(LOCK_ADAPTIVE | LOCK_HANDOFF);
+	unintr_printf("lock handoff test done\n");
+	return 0;
+}
@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <string.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests priority inheritance for locks:
+ *
+ * - A low priority thread that holds lock A, which a thread of middling
+ *   priority waits for while it holds lock B, which a high priority thread
+ *   waits for, runs at the high priority, ahead of a thread that is ready
+ *   at a priority in between. So does the middling thread once it gets A.
+ *   Each of them goes back to its own priority when it releases the lock
+ *   it was boosted for.
+ * - A holder boosted by a lock_acquire_timeout goes back to its own
+ *   priority when that times out, and a holder boosted by a thread
+ *   blocked in lock_acquire goes back when that thread is killed.
+ *   These run with a single worker only, so that every thread runs
+ *   when we expect it to.
+ * - With timer interrupts on, a high priority thread waits for a lock held
+ *   by a low priority thread, while NHOGS threads of middling priority spin.
+ *   The holder inherits the high priority, so the wait lasts about as long
+ *   as the holder's critical section, instead of as long as it takes the
+ *   holder to get its share of the CPU among the hogs. With more workers
+ *   than CPUs, each worker only gets its share of the CPU, and the bound
+ *   grows with the number of workers.
+ *****************************************************************************/
+
+#define PRIO_LOW 6
+#define PRIO_MID 5
+#define PRIO_BETWEEN 1
+#define PRIO_HIGH THREAD_PRIO_HIGHEST
+#define NHOGS 8
+#define PRIO_HOG 3
+#define NCHUNKS 200
+#define CHUNK_USECS 100		/* a critical section of 20 ms */
+
+static struct lock *a, *b;
+static struct semaphore *sem;
+static char order[16];
+static int norder;
+
+static void
+record(char c)
+{
+	int enabled = interrupts_off();
+
+	order[norder++] = c;
+	interrupts_set(enabled);
+}
+
+static void
+test_inherit_low(void *arg)
+{
+	lock_acquire(a);
+	semaphore_down(sem);
+	record('L');
+	lock_release(a);
+	thread_yield(THREAD_ANY);
+	record('l');
+}
+
+static void
+test_inherit_mid(void *arg)
+{
+	lock_acquire(b);
+	lock_acquire(a);
+	record('M');
+	lock_release(a);
+	lock_release(b);
+}
+
+static void
+test_inherit_high(void *arg)
+{
+	lock_acquire(b);
+	record('H');
+	lock_release(b);
+}
+
+static void
+test_inherit_between(void *arg)
+{
+	record('X');
+}
+
+static Tid
+create(void (*fn)(void *), int prio)
+{
+	Tid tid = thread_create_prio(fn, NULL, prio);
+
+	assert(thread_ret_ok(tid));
+	return tid;
+}
+
+static void
+test_inherit_chain(void)
+{
+	Tid low, mid, high, between;
+
+	norder = 0;
+	/* low holds a and waits on the semaphore */
+	low = create(test_inherit_low, PRIO_LOW);
+	thread_yield(low);
+	/* mid holds b and waits for a */
+	mid = create(test_inherit_mid, PRIO_MID);
+	thread_yield(mid);
+	/* high waits for b, which boosts mid, and through it low */
+	high = create(test_inherit_high, PRIO_HIGH);
+	thread_yield(high);
+	between = create(test_inherit_between, PRIO_BETWEEN);
+	semaphore_up(sem);
+	thread_wait(low, NULL);
+	thread_wait(mid, NULL);
+	thread_wait(high, NULL);
+	thread_wait(between, NULL);
+	order[norder] = '\0';
+	unintr_printf("chain order %s\n", order);
+	assert(strcmp(order, "LMHXl") == 0);
+}
+
+static void
+test_inherit_timeout_thread(void *arg)
+{
+	assert(lock_acquire_timeout(a, 1000) == 0);
+}
+
+static void
+test_inherit_timeout(void)
+{
+	Tid low, waiter, between;
+
+	norder = 0;
+	low = create(test_inherit_low, PRIO_LOW);
+	thread_yield(low);
+	waiter = create(test_inherit_timeout_thread, PRIO_HIGH);
+	thread_wait(waiter, NULL);
+	/* low is back at its own priority, below between's */
+	between = create(test_inherit_between, PRIO_BETWEEN);
+	semaphore_up(sem);
+	thread_wait(between, NULL);
+	thread_wait(low, NULL);
+	order[norder] = '\0';
+	unintr_printf("timeout order %s\n", order);
+	assert(strcmp(order, "XLl") == 0);
+}
+
+static void
+test_inherit_killed_thread(void *arg)
+{
+	lock_acquire(a);
+	record('K');
+	lock_release(a);
+}
+
+static void
+test_inherit_kill(void)
+{
+	Tid low, waiter, between;
+
+	norder = 0;
+	low = create(test_inherit_low, PRIO_LOW);
+	thread_yield(low);
+	/* waiter blocks on a, which boosts low */
+	waiter = create(test_inherit_killed_thread, PRIO_HIGH);
+	thread_yield(waiter);
+	assert(thread_kill(waiter) == waiter);
+	thread_wait(waiter, NULL);
+	/* low is back at its own priority, below between's */
+	between = create(test_inherit_between, PRIO_BETWEEN);
+	semaphore_up(sem);
+	thread_wait(between, NULL);
+	thread_wait(low, NULL);
+	order[norder] = '\0';
+	unintr_printf("kill order %s\n", order);
+	assert(strcmp(order, "XLl") == 0);
+}
+
+static volatile int stop;
+static volatile int holding;
+static long waited_us;
+
+static void
+test_inherit_hog(void *arg)
+{
+	while (!stop) {
+	}
+}
+
+static void
+test_inherit_holder(void *arg)
+{
+	int i;
+
+	lock_acquire(a);
+	holding = 1;
+	for (i = 0; i < NCHUNKS; i++) {
+		spin(CHUNK_USECS);
+	}
+	lock_release(a);
+}
+
+static void
+test_inherit_waiter(void *arg)
+{
+	struct timespec start, end, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lock_acquire(a);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lock_release(a);
+	diff = timespec_sub(&end, &start);
+	waited_us = diff.tv_sec * USEC_PER_SEC + diff.tv_nsec / 1000;
+}
+
+static void
+test_inherit_latency(void)
+{
+	char *workers = getenv("THREAD_WORKERS");
+	int nworkers = workers != NULL ? atoi(workers) : 1;
+	Tid hog[NHOGS];
+	Tid holder, waiter;
+	int i;
+
+	holder = create(test_inherit_holder, THREAD_PRIO_LOWEST);
+	while (!holding) {
+		thread_yield(THREAD_ANY);
+	}
+	for (i = 0; i < NHOGS; i++) {
+		hog[i] = create(test_inherit_hog, PRIO_HOG);
+	}
+	waiter = create(test_inherit_waiter, PRIO_HIGH);
+	thread_wait(waiter, NULL);
+	stop = 1;
+	thread_wait(holder, NULL);
+	for (i = 0; i < NHOGS; i++) {
+		thread_wait(hog[i], NULL);
+	}
+	unintr_printf("waited %ld us for a %d us critical section with %d "
+		      "hogs\n", waited_us, NCHUNKS * CHUNK_USECS, NHOGS);
+	assert(waited_us < 3L * NCHUNKS * CHUNK_USECS * nworkers);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting lock inherit test\n");
+	a = lock_create();
+	b = lock_create();
+	sem = semaphore_create(0);
+	if (getenv("THREAD_WORKERS") == NULL) {
+		test_inherit_chain();
+		test_inherit_timeout();
+		test_inherit_kill();
+	}
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_inherit_latency();
+	semaphore_destroy(sem);
+	lock_destroy(a);
+	lock_destroy(b);
+	unintr_printf("lock inherit test done\n");
+	return 0;
+}
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests lock profiling:
+ *
+ * - A LOCK_PROFILE lock counts its holds, adds up how long it was held, and
+ *   remembers the thread that held it the longest, and its hold time
+ *   histogram adds up to the number of holds.
+ * - NWAITERS threads that wait for a LOCK_PROFILE lock are counted as
+ *   contended acquisitions, and its wait time histogram adds up to them.
+ * - cv_wait counts the times it released the lock.
+ * - A lock_acquire_timeout that runs out is counted neither as an
+ *   acquisition nor as a contended one, nor in the wait time histogram.
+ * - A lock without LOCK_PROFILE does not time its holds.
+ * - lock_report(n) prints only the n most contended locks, the most
+ *   contended first (or the most acquired, for locks that never were), by
+ *   the names given to lock_create_named (truncated to
+ *   LOCK_NAME_LEN - 1 characters), or by address.
+ *****************************************************************************/
+
+#define NHOLDS 10
+#define HOLD_USECS 1000
+#define LONG_HOLD_USECS 20000
+#define NWAITERS 8
+
+static struct lock *hot;
+static struct lock *cold;
+static struct lock *plain;
+
+static unsigned long
+hist_sum(const unsigned long *hist)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < LOCK_HIST_BUCKETS; i++) {
+		sum += hist[i];
+	}
+	return sum;
+}
+
+static void
+test_profile_long_holder(void *arg)
+{
+	lock_acquire(cold);
+	spin(LONG_HOLD_USECS);
+	lock_release(cold);
+}
+
+static void
+test_profile_holds(void)
+{
+	struct lock_stats stats;
+	Tid child;
+	int i;
+
+	for (i = 0; i < NHOLDS; i++) {
+		lock_acquire(cold);
+		spin(HOLD_USECS);
+		lock_release(cold);
+	}
+	lock_get_stats(cold, &stats);
+	assert(stats.acquires == NHOLDS && stats.contended == 0);
+	assert(stats.holds == NHOLDS);
+	assert(stats.hold_ns >= NHOLDS * HOLD_USECS * 1000L);
+	assert(stats.max_hold_tid == thread_id());
+	assert(hist_sum(stats.hold_hist) == NHOLDS);
+	assert(hist_sum(stats.wait_hist) == 0);
+
+	/* a longer hold by another thread */
+	child = thread_create(test_profile_long_holder, NULL);
+	assert(thread_ret_ok(child));
+	thread_wait(child, NULL);
+	lock_get_stats(cold, &stats);
+	assert(stats.holds == NHOLDS + 1);
+	assert(stats.max_hold_tid == child);
+	assert(stats.max_hold_ns >= LONG_HOLD_USECS * 1000L);
+
+	/* no hold times without LOCK_PROFILE */
+	lock_acquire(plain);
+	lock_release(plain);
+	lock_get_stats(plain, &stats);
+	assert(stats.acquires == 1 && stats.holds == 0);
+	assert(stats.max_hold_tid == -1);
+	unintr_printf("holds ok\n");
+}
+
+static void
+test_profile_waiter(void *arg)
+{
+	lock_acquire(hot);
+	lock_release(hot);
+}
+
+static void
+test_profile_waits(void)
+{
+	struct lock_stats stats;
+	Tid child[NWAITERS];
+	int i;
+
+	lock_acquire(hot);
+	for (i = 0; i < NWAITERS; i++) {
+		child[i] = thread_create(test_profile_waiter, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	/* hold the lock until every waiter has found it held */
+	do {
+		thread_yield(THREAD_ANY);
+		lock_get_stats(hot, &stats);
+	} while (stats.contended < NWAITERS);
+	lock_release(hot);
+	for (i = 0; i < NWAITERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	lock_get_stats(hot, &stats);
+	assert(stats.acquires == NWAITERS + 1);
+	assert(stats.contended == NWAITERS);
+	assert(hist_sum(stats.wait_hist) == NWAITERS);
+	assert(stats.holds == NWAITERS + 1);
+	unintr_printf("waits ok\n");
+}
+
+static void
+test_profile_cv(void)
+{
+	struct lock_stats stats;
+	struct cv *cv = cv_create();
+
+	lock_acquire(hot);
+	assert(cv_wait_timeout(cv, hot, 1000) == 0);
+	lock_release(hot);
+	lock_get_stats(hot, &stats);
+	assert(stats.cv_waits == 1);
+	cv_destroy(cv);
+}
+
+static void
+test_profile_timeout_thread(void *arg)
+{
+	assert(lock_acquire_timeout(cold, 1000) == 0);
+}
+
+static void
+test_profile_timeout(void)
+{
+	struct lock_stats before, after;
+	Tid child;
+
+	lock_acquire(cold);
+	lock_get_stats(cold, &before);
+	child = thread_create(test_profile_timeout_thread, NULL);
+	assert(thread_ret_ok(child));
+	thread_wait(child, NULL);
+	lock_get_stats(cold, &after);
+	lock_release(cold);
+	assert(after.acquires == before.acquires);
+	assert(after.contended == before.contended);
+	assert(after.wait_ns == before.wait_ns);
+	assert(hist_sum(after.wait_hist) == after.contended);
+	assert(after.contended <= after.acquires);
+}
+
+/* Runs lock_report(n) and returns what it printed, in a malloc369'd
+ * string. */
+static char *
+report(int n)
+{
+	char path[] = "/tmp/test_lock_profile.XXXXXX";
+	int fd, saved;
+	long size;
+	char *buf;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	lock_report(n);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	size = lseek(fd, 0, SEEK_END);
+	buf = malloc369(size + 1);
+	assert(buf != NULL);
+	assert(pread(fd, buf, size, 0) == size);
+	buf[size] = '\0';
+	close(fd);
+	unlink(path);
+	return buf;
+}
+
+static void
+test_profile_report(void)
+{
+	char *out, *h, *c;
+
+	out = report(2);
+	unintr_printf("%s", out);
+	h = strstr(out, "\nhot ");
+	c = strstr(out, "\ncold_with_a_name_that_is_too_lo ");
+	assert(h != NULL && c != NULL && h < c);
+	assert(strstr(out, "hold:") != NULL && strstr(out, "wait:") != NULL);
+	/* plain, the least contended, is left out */
+	assert(strstr(out, "0x") == NULL);
+	free369(out);
+
+	out = report(3);
+	assert(strstr(out, "\n0x") != NULL);
+	free369(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting lock profile test\n");
+	hot = lock_create_named("hot", LOCK_PROFILE);
+	cold = lock_create_named("cold_with_a_name_that_is_too_long_to_keep",
+				 LOCK_PROFILE);
+	plain = lock_create();
+	test_profile_holds();
+	test_profile_waits();
+	test_profile_cv();
+	test_profile_timeout();
+	test_profile_report();
+	lock_destroy(hot);
+	lock_destroy(cold);
+	lock_destroy(plain);
+	unintr_printf("lock profile test done\n");
+	return 0;
+}
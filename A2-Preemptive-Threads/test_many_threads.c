@@ -0,0 +1,145 @@
+#include <time.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests a thread table grown far past THREAD_MAX_THREADS:
+ *
+ * - thread_set_max_threads rejects ceilings out of range, and returns the
+ *   previous one.
+ * - NMANY threads, all sleeping on a semaphore at once, fit in a memory
+ *   budget of BYTES_PER_THREAD bytes of resident memory each.
+ * - A timer tick, counting the priority boosts every so many ticks, costs
+ *   no more with NMANY threads sleeping than with none, within TICK_SLACK_NS.
+ * - thread_kill and thread_wait reject ids that were never handed out.
+ * - Every thread is woken up, exits with its own exit code, and is reaped,
+ *   and its id is reused by the next thread_create.
+ * - No more than the ceiling can be created.
+ *****************************************************************************/
+
+#define NMANY 100000
+#define BYTES_PER_THREAD 16384
+#define NTICKS 10000
+#define TICK_SLACK_NS 1000
+
+static struct semaphore *sem;
+static int arrived;
+static Tid child[NMANY];
+
+static void
+test_many_thread(void *arg)
+{
+	__atomic_add_fetch(&arrived, 1, __ATOMIC_RELAXED);
+	semaphore_down(sem);
+	thread_exit((long)arg);
+}
+
+static void
+test_idle_thread(void *arg)
+{
+	semaphore_down(sem);
+}
+
+/* Returns the mean time in nanoseconds of a timer tick, over NTICKS calls
+ * to thread_preempt. */
+static long
+tick_ns(void)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NTICKS; i++) {
+		thread_preempt();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start.tv_sec) * 1000000000L +
+		end.tv_nsec - start.tv_nsec) / NTICKS;
+}
+
+/* Returns the resident set size of the process in bytes. */
+static long
+resident_bytes(void)
+{
+	long size, resident;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	assert(f != NULL);
+	assert(fscanf(f, "%ld %ld", &size, &resident) == 2);
+	fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+int
+main(int argc, char **argv)
+{
+	long before, after;
+	long idle_tick, busy_tick;
+	int exit_code;
+	long i;
+	Tid ret;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting many threads test\n");
+	assert(thread_set_max_threads(0) == THREAD_INVALID);
+	assert(thread_set_max_threads(THREAD_MAX_THREADS_LIMIT + 1) ==
+	       THREAD_INVALID);
+	assert(thread_set_max_threads(NMANY + 1) == THREAD_MAX_THREADS);
+
+	sem = semaphore_create(0);
+	idle_tick = tick_ns();
+	before = resident_bytes();
+	for (i = 0; i < NMANY; i++) {
+		child[i] = thread_create(test_many_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	/* the ceiling counts the initial thread */
+	assert(thread_create(test_idle_thread, NULL) == THREAD_NOMORE);
+	while (__atomic_load_n(&arrived, __ATOMIC_RELAXED) < NMANY) {
+		thread_yield(THREAD_ANY);
+	}
+	after = resident_bytes();
+	unintr_printf("%d sleeping threads: %ld bytes resident per thread\n",
+		      NMANY, (after - before) / NMANY);
+	assert((after - before) / NMANY < BYTES_PER_THREAD);
+
+	/* priority boosts do not visit every thread */
+	busy_tick = tick_ns();
+	unintr_printf("timer tick: %ld ns, %ld ns with %d sleeping threads\n",
+		      idle_tick, busy_tick, NMANY);
+	assert(busy_tick < 2 * idle_tick + TICK_SLACK_NS);
+
+	/* the table has grown, and only up to the ids handed out */
+	assert(thread_set_max_threads(NMANY) == THREAD_INVALID);
+	assert(thread_kill(NMANY + 1) == THREAD_INVALID);
+	assert(thread_wait(NMANY + 1, NULL) == THREAD_INVALID);
+	assert(thread_kill(THREAD_MAX_THREADS_LIMIT) == THREAD_INVALID);
+
+	for (i = 0; i < NMANY; i++) {
+		semaphore_up(sem);
+	}
+	for (i = 0; i < NMANY; i++) {
+		assert(thread_wait(child[i], &exit_code) == child[i]);
+		assert(exit_code == i);
+	}
+
+	/* ids are reused once their threads are reaped */
+	ret = thread_create(test_idle_thread, NULL);
+	assert(thread_ret_ok(ret) && ret <= NMANY);
+	semaphore_up(sem);
+	thread_wait(ret, NULL);
+	semaphore_destroy(sem);
+	unintr_printf("many threads test done\n");
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <limits.h>
+#include <stdlib.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests address-keyed waiting:
+ *
+ * - thread_park returns at once if the word does not hold the expected
+ *   value.
+ * - thread_unpark(addr, n) wakes up n of the threads parked on addr, in the
+ *   order they parked, and none of those parked on another address.
+ * - A killed thread leaves the queue of its address, and thread_unpark does
+ *   not count it.
+ *   These two run with a single worker only, as with more workers the
+ *   threads may not park, or run once woken, in the order we switch to them.
+ * - With timer interrupts on, NLOCKERS threads increment a counter under a
+ *   mutex that is a single int, built on thread_park and thread_unpark.
+ *****************************************************************************/
+
+#define NPARKED 6
+#define NLOCKERS 16
+#define NINCS 2000
+
+static int words[2];
+static int order[NPARKED];
+static int nwoken;
+
+static void
+test_park_thread(void *arg)
+{
+	long i = (long)arg;
+	int enabled;
+
+	assert(thread_park(&words[i % 2], 0) == 1);
+	enabled = interrupts_off();
+	order[nwoken++] = i;
+	interrupts_set(enabled);
+}
+
+static void
+test_park_unpark(void)
+{
+	Tid child[NPARKED];
+	long i;
+
+	assert(thread_park(&words[0], 1) == 0);
+	/* even threads park on words[0], odd ones on words[1] */
+	for (i = 0; i < NPARKED; i++) {
+		child[i] = thread_create(test_park_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+		thread_yield(child[i]);
+	}
+	assert(thread_unpark(&words[0], 2) == 2);
+	thread_yield(THREAD_ANY);
+	thread_yield(THREAD_ANY);
+	assert(nwoken == 2 && order[0] == 0 && order[1] == 2);
+
+	/* the last one on words[0] is killed */
+	assert(thread_kill(child[4]) == child[4]);
+	assert(thread_unpark(&words[0], INT_MAX) == 0);
+	assert(thread_unpark(&words[1], INT_MAX) == NPARKED / 2);
+	for (i = 0; i < NPARKED; i++) {
+		if (i != 4) {
+			thread_wait(child[i], NULL);
+		}
+	}
+	assert(nwoken == NPARKED - 1);
+	assert(order[2] == 1 && order[3] == 3 && order[4] == 5);
+	assert(thread_unpark(&words[1], 1) == 0);
+	unintr_printf("unpark ok\n");
+}
+
+/* A mutex in one int: 0 is unlocked, 1 locked, and 2 locked with threads
+ * that may be parked on it. */
+static void
+mutex_lock(int *m)
+{
+	int c = 0;
+
+	if (__atomic_compare_exchange_n(m, &c, 1, false, __ATOMIC_ACQUIRE,
+					__ATOMIC_RELAXED)) {
+		return;
+	}
+	if (c != 2) {
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+	while (c != 0) {
+		thread_park(m, 2);
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+static void
+mutex_unlock(int *m)
+{
+	if (__atomic_fetch_sub(m, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(m, 0, __ATOMIC_RELEASE);
+		thread_unpark(m, 1);
+	}
+}
+
+static int mutex;
+static volatile long counter;
+
+static void
+test_park_locker(void *arg)
+{
+	long c;
+	int i;
+
+	for (i = 0; i < NINCS; i++) {
+		mutex_lock(&mutex);
+		c = counter;
+		/* give others a chance to run inside the critical section */
+		if (i % 16 == 0) {
+			thread_yield(THREAD_ANY);
+		}
+		counter = c + 1;
+		mutex_unlock(&mutex);
+	}
+}
+
+static void
+test_park_mutex(void)
+{
+	Tid child[NLOCKERS];
+	int i;
+
+	for (i = 0; i < NLOCKERS; i++) {
+		child[i] = thread_create(test_park_locker, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NLOCKERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("counter is %ld\n", counter);
+	assert(counter == NLOCKERS * NINCS);
+	assert(mutex == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting park test\n");
+	if (getenv("THREAD_WORKERS") == NULL) {
+		test_park_unpark();
+	} else {
+		assert(thread_park(&words[0], 1) == 0);
+	}
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_park_mutex();
+	unintr_printf("park test done\n");
+	return 0;
+}
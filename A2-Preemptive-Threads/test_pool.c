@@ -0,0 +1,158 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests thread pools:
+ *
+ * - NTASKS tasks submitted to a pool of NPOOL threads all run, on the pool's
+ *   threads, and future_get returns each one's result, whether the task has
+ *   finished by then or not.
+ * - A task that blocks does not hold up the others: a task waiting on a
+ *   semaphore is let go by a task submitted after it.
+ * - With timer interrupts on, NSPIN tasks that spin are preempted, and all
+ *   of them run.
+ *****************************************************************************/
+
+#define NPOOL 8
+#define NTASKS 10000
+#define NSPIN 200
+#define SPIN_USECS 1000
+
+static Tid pool_tids[NPOOL];
+static int npool_tids;
+static int ran;
+
+static void *
+test_pool_square(void *arg)
+{
+	long x = (long)arg;
+	Tid self = thread_id();
+	int enabled;
+	int i;
+
+	/* remember which threads run the tasks */
+	enabled = interrupts_off();
+	for (i = 0; i < npool_tids && pool_tids[i] != self; i++) {
+	}
+	if (i == npool_tids) {
+		assert(npool_tids < NPOOL);
+		pool_tids[npool_tids++] = self;
+	}
+	interrupts_set(enabled);
+	return (void *)(x * x);
+}
+
+static void
+test_pool_results(void)
+{
+	static struct future *f[NTASKS];
+	struct pool *pool;
+	long i;
+
+	pool = pool_create(NPOOL);
+	assert(pool != NULL);
+	for (i = 0; i < NTASKS; i++) {
+		f[i] = pool_submit(pool, test_pool_square, (void *)i);
+		/* wait for some as soon as they are submitted, and some later */
+		if (i % 2 == 0) {
+			assert(future_get(f[i]) == (void *)(i * i));
+		}
+	}
+	for (i = 1; i < NTASKS; i += 2) {
+		assert(future_get(f[i]) == (void *)(i * i));
+	}
+	pool_destroy(pool);
+	unintr_printf("%d tasks on %d pool threads\n", NTASKS, npool_tids);
+	assert(npool_tids > 0);
+	for (i = 0; i < npool_tids; i++) {
+		assert(pool_tids[i] != thread_id());
+	}
+}
+
+static struct semaphore *sem;
+
+static void *
+test_pool_down(void *arg)
+{
+	semaphore_down(sem);
+	return arg;
+}
+
+static void *
+test_pool_up(void *arg)
+{
+	semaphore_up(sem);
+	return arg;
+}
+
+static void
+test_pool_blocking(void)
+{
+	struct future *down, *up;
+	struct pool *pool;
+
+	sem = semaphore_create(0);
+	pool = pool_create(2);
+	assert(pool != NULL);
+	down = pool_submit(pool, test_pool_down, (void *)1);
+	up = pool_submit(pool, test_pool_up, (void *)2);
+	assert(future_get(down) == (void *)1);
+	assert(future_get(up) == (void *)2);
+	pool_destroy(pool);
+	semaphore_destroy(sem);
+}
+
+static void *
+test_pool_spin(void *arg)
+{
+	spin(SPIN_USECS);
+	__atomic_add_fetch(&ran, 1, __ATOMIC_RELAXED);
+	return arg;
+}
+
+static void
+test_pool_spinning(void)
+{
+	static struct future *f[NSPIN];
+	struct pool *pool;
+	long i;
+
+	ran = 0;
+	pool = pool_create(NPOOL);
+	assert(pool != NULL);
+	for (i = 0; i < NSPIN; i++) {
+		f[i] = pool_submit(pool, test_pool_spin, (void *)i);
+	}
+	for (i = 0; i < NSPIN; i++) {
+		assert(future_get(f[i]) == (void *)i);
+	}
+	pool_destroy(pool);
+	unintr_printf("%d spinning tasks\n", ran);
+	assert(ran == NSPIN);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting pool test\n");
+	test_pool_results();
+	test_pool_blocking();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_pool_spinning();
+	unintr_printf("pool test done\n");
+	return 0;
+}
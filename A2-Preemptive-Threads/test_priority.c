@@ -0,0 +1,156 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * NHOGS CPU-bound threads spin, while an interactive thread sleeps on a wait
+ * queue and is woken up by the initial thread NWAKEUPS times. We measure the
+ * time from each thread_wakeup until the interactive thread runs.
+ *
+ * The hogs use up their quanta and sink to the lowest priority level, while
+ * the interactive thread keeps its priority because it blocks. So it should
+ * run at the next timer tick after it is woken up, instead of waiting for
+ * every hog to run a quantum as it would with a single FIFO ready queue.
+ *****************************************************************************/
+
+#define NHOGS 8
+#define NWAKEUPS 200
+
+static volatile int stop;
+static volatile int waiting;
+static struct timespec wake_time;
+static long latency[NWAKEUPS];
+static struct wait_queue *queue;
+
+static void
+test_priority_hog(void *arg)
+{
+	while (!stop) {
+	}
+}
+
+static void
+test_priority_interactive(void *arg)
+{
+	struct timespec now;
+	struct timespec diff;
+	int i;
+	int enabled;
+
+	for (i = 0; i < NWAKEUPS; i++) {
+		/* interrupts stay off until we are on the wait queue, so the
+		 * wakeup cannot be missed */
+		enabled = interrupts_off();
+		waiting = 1;
+		thread_sleep(queue);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		diff = timespec_sub(&now, &wake_time);
+		latency[i] = diff.tv_sec * USEC_PER_SEC + diff.tv_nsec / 1000;
+		interrupts_set(enabled);
+	}
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Runs the test with the interactive thread at priority prio, and returns
+ * the median wakeup-to-run latency in usecs. */
+static long
+test_priority(int prio)
+{
+	Tid hog[NHOGS];
+	Tid interactive;
+	int enabled;
+	int nwakeups = 0;
+	int i;
+
+	stop = 0;
+	waiting = 0;
+	for (i = 0; i < NHOGS; i++) {
+		hog[i] = thread_create(test_priority_hog, NULL);
+		assert(thread_ret_ok(hog[i]));
+	}
+	interactive = thread_create_prio(test_priority_interactive, NULL, prio);
+	assert(thread_ret_ok(interactive));
+
+	while (nwakeups < NWAKEUPS) {
+		spin(300 + rand() % 700);
+		enabled = interrupts_off();
+		if (waiting) {
+			waiting = 0;
+			clock_gettime(CLOCK_MONOTONIC, &wake_time);
+			thread_wakeup(queue, 0);
+			nwakeups++;
+		}
+		interrupts_set(enabled);
+	}
+	thread_wait(interactive, NULL);
+	stop = 1;
+	for (i = 0; i < NHOGS; i++) {
+		thread_wait(hog[i], NULL);
+	}
+
+	qsort(latency, NWAKEUPS, sizeof(long), cmp_long);
+	unintr_printf("prio %d: wakeup-to-run latency us: p50 %5ld p90 %5ld "
+		      "p99 %5ld max %5ld\n", prio, latency[NWAKEUPS / 2],
+		      latency[NWAKEUPS * 9 / 10], latency[NWAKEUPS * 99 / 100],
+		      latency[NWAKEUPS - 1]);
+	return latency[NWAKEUPS / 2];
+}
+
+int
+main(int argc, char **argv)
+{
+	long p50[2];
+	Tid ret;
+	int i;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting priority test\n");
+	ret = thread_create_prio(test_priority_hog, NULL, THREAD_PRIO_LEVELS);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_priority(THREAD_MAX_THREADS, THREAD_PRIO_DEFAULT);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_priority(thread_id(), -1);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_priority(thread_id(), THREAD_PRIO_DEFAULT);
+	assert(ret == thread_id());
+
+	queue = wait_queue_create();
+	/* the interactive thread relies on feedback alone */
+	p50[0] = test_priority(THREAD_PRIO_DEFAULT);
+	/* the interactive thread is also given a higher priority */
+	p50[1] = test_priority(THREAD_PRIO_HIGHEST);
+	wait_queue_destroy(queue);
+
+	/* With a single FIFO ready queue, a woken thread waits for all the
+	 * hogs, about NHOGS quanta. Allow half of that. */
+	for (i = 0; i < 2; i++) {
+		if (p50[i] > NHOGS * SIG_INTERVAL / 2) {
+			unintr_printf("priority test failed: median latency "
+				      "%ld us\n", p50[i]);
+			return 1;
+		}
+	}
+	unintr_printf("priority test done\n");
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Two CPU-bound threads spin for DURATION usecs, and every time one of them
+ * notices that the other thread ran since it last looked, it counts a
+ * switch. Only timer interrupts switch between them, so the number of
+ * switches should be close to DURATION / quantum. We run the test with a
+ * short and a long quantum set by thread_set_quantum().
+ *****************************************************************************/
+
+#define DURATION 500000 /* usecs each quantum is measured for */
+
+static volatile Tid last_runner;
+static volatile long nswitches;
+static volatile int stop;
+
+static void
+test_quantum_thread(void *arg)
+{
+	while (!stop) {
+		if (last_runner != thread_id()) {
+			last_runner = thread_id();
+			nswitches++;
+		}
+	}
+}
+
+static long
+test_quantum(unsigned long usecs)
+{
+	Tid child[2];
+	long nticks = DURATION / usecs;
+	int i;
+
+	thread_set_quantum(usecs);
+	stop = 0;
+	nswitches = 0;
+	last_runner = thread_id();
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_quantum_thread, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+
+	/* the initial thread spins too, so three threads share the CPU */
+	spin(DURATION);
+	stop = 1;
+	for (i = 0; i < 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+
+	unintr_printf("quantum %6lu us: %5ld switches in %5ld timer ticks\n",
+		      usecs, nswitches, nticks);
+	return nswitches;
+}
+
+int
+main(int argc, char **argv)
+{
+	long fast, slow;
+	long ret;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting quantum test\n");
+	ret = thread_set_quantum(0);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_quantum(SIG_INTERVAL);
+	assert(ret == SIG_INTERVAL);
+
+	fast = test_quantum(100);
+	slow = test_quantum(10000);
+
+	/* The fast quantum should switch at least 10 times more often. The
+	 * ideal ratio is 100, but a loaded machine delivers fewer ticks. */
+	if (fast < 10 * slow) {
+		unintr_printf("quantum test failed: %ld switches at 100 us, "
+			      "%ld at 10000 us\n", fast, slow);
+		return 1;
+	}
+	unintr_printf("quantum test done\n");
+	return 0;
+}
@@ -0,0 +1,211 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests the reader-writer lock:
+ *
+ * - NREADERS readers that yield while they hold the lock all hold it at once.
+ * - A reader that arrives while a writer waits queues up behind the writer.
+ * - A writer that unlocks lets in all the waiting readers before the next
+ *   writer.
+ * - With timer interrupts on, readers that keep the lock busy do not starve
+ *   the writers, and a writer never shares the lock.
+ *****************************************************************************/
+
+#define NREADERS 8
+#define NWRITERS 4
+#define NWRITES 50
+
+static struct rwlock *rw;
+static volatile int readers_inside;
+static volatile int writers_inside;
+static int max_readers_inside;
+static int order[NREADERS + 2];
+static int norder;
+static volatile int stop;
+
+static void
+test_rwlock_reader(void *arg)
+{
+	int enabled;
+	int i;
+
+	rwlock_rdlock(rw);
+	/* readers may run in parallel in M:N mode */
+	enabled = interrupts_off();
+	order[norder++] = (long)arg;
+	readers_inside++;
+	if (readers_inside > max_readers_inside) {
+		max_readers_inside = readers_inside;
+	}
+	interrupts_set(enabled);
+	for (i = 0; i < NREADERS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	__atomic_sub_fetch(&readers_inside, 1, __ATOMIC_RELAXED);
+	rwlock_unlock(rw);
+}
+
+static void
+test_rwlock_writer(void *arg)
+{
+	rwlock_wrlock(rw);
+	order[norder++] = (long)arg;
+	assert(readers_inside == 0);
+	rwlock_unlock(rw);
+}
+
+/* Readers share the lock. */
+static void
+test_rwlock_share(void)
+{
+	Tid child[NREADERS];
+	long i;
+
+	max_readers_inside = 0;
+	norder = 0;
+	for (i = 0; i < NREADERS; i++) {
+		child[i] = thread_create(test_rwlock_reader, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NREADERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("%d readers held the lock at once\n",
+		      max_readers_inside);
+	assert(max_readers_inside == NREADERS);
+}
+
+/* A waiting writer goes before a reader that arrives after it. */
+static void
+test_rwlock_writer_first(void)
+{
+	Tid writer, reader;
+
+	norder = 0;
+	rwlock_rdlock(rw);
+	writer = thread_create(test_rwlock_writer, (void *)100);
+	thread_yield(writer);
+	reader = thread_create(test_rwlock_reader, (void *)0);
+	thread_yield(reader);
+	/* both are waiting */
+	assert(norder == 0);
+	rwlock_unlock(rw);
+	thread_wait(writer, NULL);
+	thread_wait(reader, NULL);
+	assert(norder == 2 && order[0] == 100 && order[1] == 0);
+}
+
+/* A writer that unlocks lets in all the waiting readers, as a batch, before
+ * the next writer. */
+static void
+test_rwlock_batch(void)
+{
+	Tid child[NREADERS + 1];
+	long i;
+
+	norder = 0;
+	max_readers_inside = 0;
+	rwlock_wrlock(rw);
+	for (i = 0; i < NREADERS; i++) {
+		child[i] = thread_create(test_rwlock_reader, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	child[NREADERS] = thread_create(test_rwlock_writer, (void *)100);
+	assert(thread_ret_ok(child[NREADERS]));
+	thread_yield(THREAD_ANY);
+	assert(norder == 0);
+	rwlock_unlock(rw);
+	for (i = 0; i <= NREADERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	assert(norder == NREADERS + 1);
+	for (i = 0; i < NREADERS; i++) {
+		assert(order[i] == i);
+	}
+	assert(order[NREADERS] == 100);
+	assert(max_readers_inside == NREADERS);
+}
+
+static void
+test_rwlock_busy_reader(void *arg)
+{
+	while (!stop) {
+		rwlock_rdlock(rw);
+		__atomic_add_fetch(&readers_inside, 1, __ATOMIC_RELAXED);
+		assert(writers_inside == 0);
+		spin(100);
+		__atomic_sub_fetch(&readers_inside, 1, __ATOMIC_RELAXED);
+		rwlock_unlock(rw);
+	}
+}
+
+static void
+test_rwlock_busy_writer(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NWRITES; i++) {
+		rwlock_wrlock(rw);
+		writers_inside++;
+		assert(writers_inside == 1 && readers_inside == 0);
+		spin(100);
+		writers_inside--;
+		rwlock_unlock(rw);
+	}
+}
+
+/* Busy readers do not starve the writers. */
+static void
+test_rwlock_no_starvation(void)
+{
+	Tid reader[NREADERS];
+	Tid writer[NWRITERS];
+	int i;
+
+	stop = 0;
+	for (i = 0; i < NREADERS; i++) {
+		reader[i] = thread_create(test_rwlock_busy_reader, NULL);
+		assert(thread_ret_ok(reader[i]));
+	}
+	for (i = 0; i < NWRITERS; i++) {
+		writer[i] = thread_create(test_rwlock_busy_writer, NULL);
+		assert(thread_ret_ok(writer[i]));
+	}
+	for (i = 0; i < NWRITERS; i++) {
+		thread_wait(writer[i], NULL);
+	}
+	stop = 1;
+	for (i = 0; i < NREADERS; i++) {
+		thread_wait(reader[i], NULL);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting rwlock test\n");
+	rw = rwlock_create();
+	test_rwlock_share();
+	test_rwlock_writer_first();
+	test_rwlock_batch();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_rwlock_no_starvation();
+	rwlock_destroy(rw);
+	unintr_printf("rwlock test done\n");
+	return 0;
+}
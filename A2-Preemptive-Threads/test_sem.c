@@ -0,0 +1,186 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests semaphores and barriers:
+ *
+ * - A unit handed to a waiter that is killed before it runs goes to the next
+ *   waiter.
+ * - Producers and consumers share a bounded buffer guarded by semaphores,
+ *   with timer interrupts on. Every item must be consumed once, and the
+ *   buffer must never hold more than BUFSIZE items.
+ * - NBARRIER threads run NPHASES phases separated by a barrier, with timer
+ *   interrupts on. No thread may start a phase before all of them finished
+ *   the previous one, and barrier_wait must return 1 once per phase.
+ *****************************************************************************/
+
+#define BUFSIZE 8
+#define NPRODUCERS 4
+#define NCONSUMERS 4
+#define NITEMS 2000		/* per producer */
+#define NBARRIER 16		/* threads on the barrier */
+#define NPHASES 200
+
+static struct semaphore *empty, *full, *mutex;
+static long buffer[BUFSIZE];
+static int head, tail, count;
+static long consumed_sum;
+static int ran;
+
+static void
+test_sem_waiter(void *arg)
+{
+	semaphore_down(full);
+	ran = (long)arg;
+}
+
+static void
+test_sem_kill(void)
+{
+	Tid child[2];
+	long i;
+
+	full = semaphore_create(0);
+	ran = 0;
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_sem_waiter, (void *)(i + 1));
+		assert(thread_ret_ok(child[i]));
+	}
+	thread_yield(THREAD_ANY);
+	/* the unit goes to child 0, which is killed before it runs */
+	semaphore_up(full);
+	assert(thread_kill(child[0]) == child[0]);
+	assert(thread_wait(child[1], NULL) == child[1]);
+	assert(ran == 2);
+	semaphore_destroy(full);
+}
+
+static void
+test_sem_producer(void *arg)
+{
+	long base = (long)arg * NITEMS;
+	long i;
+
+	for (i = 0; i < NITEMS; i++) {
+		semaphore_down(empty);
+		semaphore_down(mutex);
+		buffer[tail] = base + i;
+		tail = (tail + 1) % BUFSIZE;
+		count++;
+		assert(count <= BUFSIZE);
+		semaphore_up(mutex);
+		semaphore_up(full);
+	}
+}
+
+static void
+test_sem_consumer(void *arg)
+{
+	long sum = 0;
+	int i;
+
+	for (i = 0; i < NPRODUCERS * NITEMS / NCONSUMERS; i++) {
+		semaphore_down(full);
+		semaphore_down(mutex);
+		sum += buffer[head];
+		head = (head + 1) % BUFSIZE;
+		count--;
+		assert(count >= 0);
+		semaphore_up(mutex);
+		semaphore_up(empty);
+	}
+	__atomic_add_fetch(&consumed_sum, sum, __ATOMIC_RELAXED);
+}
+
+static void
+test_sem_bounded_buffer(void)
+{
+	Tid child[NPRODUCERS + NCONSUMERS];
+	long n = (long)NPRODUCERS * NITEMS;
+	long i;
+
+	empty = semaphore_create(BUFSIZE);
+	full = semaphore_create(0);
+	mutex = semaphore_create(1);
+	for (i = 0; i < NPRODUCERS; i++) {
+		child[i] = thread_create(test_sem_producer, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCONSUMERS; i++) {
+		child[NPRODUCERS + i] = thread_create(test_sem_consumer, NULL);
+		assert(thread_ret_ok(child[NPRODUCERS + i]));
+	}
+	for (i = 0; i < NPRODUCERS + NCONSUMERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("consumed %ld items\n", n);
+	assert(count == 0);
+	assert(consumed_sum == n * (n - 1) / 2);
+	semaphore_destroy(empty);
+	semaphore_destroy(full);
+	semaphore_destroy(mutex);
+}
+
+static struct barrier *barrier;
+static int arrived[NPHASES];
+static int nserial;
+
+static void
+test_barrier_thread(void *arg)
+{
+	int phase;
+
+	for (phase = 0; phase < NPHASES; phase++) {
+		__atomic_add_fetch(&arrived[phase], 1, __ATOMIC_RELAXED);
+		spin((phase * 7 + (long)arg) % 50);
+		if (barrier_wait(barrier)) {
+			__atomic_add_fetch(&nserial, 1, __ATOMIC_RELAXED);
+		}
+		assert(arrived[phase] == NBARRIER);
+	}
+}
+
+static void
+test_barrier(void)
+{
+	Tid child[NBARRIER];
+	int i;
+
+	barrier = barrier_create(NBARRIER);
+	for (i = 0; i < NBARRIER; i++) {
+		child[i] = thread_create(test_barrier_thread, (void *)(long)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NBARRIER; i++) {
+		thread_wait(child[i], NULL);
+	}
+	unintr_printf("%d barrier phases\n", nserial);
+	assert(nserial == NPHASES);
+	barrier_destroy(barrier);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting semaphore test\n");
+	test_sem_kill();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_sem_bounded_buffer();
+	test_barrier();
+	unintr_printf("semaphore test done\n");
+	return 0;
+}
@@ -0,0 +1,275 @@
+#include <sys/resource.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests timed sleeps:
+ *
+ * - Threads sleeping for different times wake up in order. This runs before
+ *   timer interrupts are turned on: a thread that is preempted just after it
+ *   wakes up is demoted, and rightly runs after the threads woken behind it.
+ *
+ * With timer interrupts on:
+ *
+ * - thread_sleep_for sleeps at least as long as asked, including for times
+ *   that start on the higher levels of the timer wheel.
+ * - cv_wait_timeout returns 0 when nobody signals, and 1 when it is
+ *   signalled in time. lock_acquire_timeout gives up on a held lock, and
+ *   gets a lock that is released in time.
+ * - A killed thread in a timed sleep exits right away.
+ * - NWAITERS threads that wait for time with thread_sleep_for use a small
+ *   fraction of the CPU, where the same threads busy waiting with spin() use
+ *   all of it.
+ *****************************************************************************/
+
+#define NORDERED 16
+#define NWAITERS 32
+#define WAIT_USECS 2000
+#define NWAITS 50
+
+static struct lock *lock;
+static struct cv *cv;
+static int woken[NORDERED];
+static int nwoken;
+static volatile int holding;
+
+static long
+elapsed_us(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	diff = timespec_sub(&now, start);
+	return diff.tv_sec * USEC_PER_SEC + diff.tv_nsec / 1000;
+}
+
+static void
+test_sleep_duration(unsigned long usecs)
+{
+	struct timespec start;
+	long us;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	thread_sleep_for(usecs);
+	us = elapsed_us(&start);
+	unintr_printf("slept %lu us: woke up after %ld us\n", usecs, us);
+	assert(us >= (long)usecs);
+	assert(us < (long)usecs + 100000);
+}
+
+static void
+test_sleep_ordered_thread(void *arg)
+{
+	long i = (long)arg;
+	int enabled;
+
+	thread_sleep_for(1000 + i * 500);
+	enabled = interrupts_off();
+	woken[nwoken++] = i;
+	interrupts_set(enabled);
+}
+
+static void
+test_sleep_ordered(void)
+{
+	Tid child[NORDERED];
+	long i;
+
+	nwoken = 0;
+	/* create them in reverse order of their wakeup times */
+	for (i = NORDERED - 1; i >= 0; i--) {
+		child[i] = thread_create(test_sleep_ordered_thread, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NORDERED; i++) {
+		thread_wait(child[i], NULL);
+	}
+	for (i = 0; i < NORDERED; i++) {
+		assert(woken[i] == i);
+	}
+}
+
+static void
+test_sleep_signaller(void *arg)
+{
+	thread_sleep_for(1000);
+	lock_acquire(lock);
+	cv_signal(cv, lock);
+	lock_release(lock);
+}
+
+static void
+test_sleep_holder(void *arg)
+{
+	lock_acquire(lock);
+	holding = 1;
+	thread_sleep_for((long)arg);
+	holding = 0;
+	lock_release(lock);
+}
+
+static void
+test_sleep_timeouts(void)
+{
+	struct timespec start;
+	Tid child;
+	int ret;
+
+	lock = lock_create();
+	cv = cv_create();
+
+	/* nobody signals */
+	lock_acquire(lock);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = cv_wait_timeout(cv, lock, 5000);
+	assert(ret == 0);
+	assert(elapsed_us(&start) >= 5000);
+	assert(lock_acquire_timeout(lock, 0) == 1);	/* still ours */
+
+	/* signalled in time */
+	child = thread_create(test_sleep_signaller, NULL);
+	assert(thread_ret_ok(child));
+	ret = cv_wait_timeout(cv, lock, 1000000);
+	assert(ret == 1);
+	assert(elapsed_us(&start) < 500000);
+	lock_release(lock);
+	thread_wait(child, NULL);
+
+	/* the lock is held for longer than we wait */
+	child = thread_create(test_sleep_holder, (void *)100000L);
+	/* it may be preempted before it takes the lock */
+	while (!holding) {
+		thread_yield(child);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = lock_acquire_timeout(lock, 5000);
+	assert(ret == 0);
+	assert(elapsed_us(&start) >= 5000);
+	/* and then for shorter */
+	ret = lock_acquire_timeout(lock, 1000000);
+	assert(ret == 1);
+	lock_release(lock);
+	thread_wait(child, NULL);
+
+	cv_destroy(cv);
+	lock_destroy(lock);
+}
+
+static void
+test_sleep_victim(void *arg)
+{
+	thread_sleep_for(10 * USEC_PER_SEC);
+	assert(0);
+}
+
+static void
+test_sleep_kill(void)
+{
+	struct timespec start;
+	Tid child;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	child = thread_create(test_sleep_victim, NULL);
+	thread_yield(child);
+	assert(thread_kill(child) == child);
+	/* it exits the next time it runs, long before its timer */
+	thread_yield(THREAD_ANY);
+	thread_sleep_for(1000);
+	assert(thread_yield(child) == THREAD_INVALID);
+	assert(elapsed_us(&start) < USEC_PER_SEC);
+}
+
+static volatile int use_spin;
+
+static void
+test_sleep_waiter(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NWAITS; i++) {
+		if (use_spin) {
+			spin(WAIT_USECS);
+		} else {
+			thread_sleep_for(WAIT_USECS);
+		}
+	}
+}
+
+static double
+cpu_seconds(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Returns the CPU time used per second of wall-clock time while NWAITERS
+ * threads wait NWAITS times for WAIT_USECS each. */
+static double
+test_sleep_cpu(bool spinning)
+{
+	Tid child[NWAITERS];
+	struct timespec start;
+	double cpu, wall;
+	int i;
+
+	use_spin = spinning;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cpu = cpu_seconds();
+	for (i = 0; i < NWAITERS; i++) {
+		child[i] = thread_create(test_sleep_waiter, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NWAITERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	cpu = cpu_seconds() - cpu;
+	wall = elapsed_us(&start) / 1e6;
+	unintr_printf("%s: %.3f s wall, %.3f s cpu, %.0f%% cpu\n",
+		      spinning ? "spin" : "thread_sleep_for", wall, cpu,
+		      100 * cpu / wall);
+	return cpu / wall;
+}
+
+int
+main(int argc, char **argv)
+{
+	double spin_cpu, sleep_cpu;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting sleep_for test\n");
+	test_sleep_ordered();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_sleep_duration(0);
+	test_sleep_duration(1000);
+	/* past level 0, and past level 1, of the wheel */
+	test_sleep_duration(20000);
+	test_sleep_duration(600000);
+	test_sleep_timeouts();
+	test_sleep_kill();
+
+	spin_cpu = test_sleep_cpu(true);
+	sleep_cpu = test_sleep_cpu(false);
+	if (sleep_cpu > 0.5 || sleep_cpu > spin_cpu / 2) {
+		unintr_printf("sleep_for test failed: sleeping threads used "
+			      "too much CPU\n");
+		return 1;
+	}
+	unintr_printf("sleep_for test done\n");
+	return 0;
+}
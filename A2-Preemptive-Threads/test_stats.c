@@ -0,0 +1,149 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests the per-thread scheduling statistics. Each thread reads its own
+ * statistics just before it returns:
+ *
+ * - A thread in thread_sleep_for is charged blocked time, not CPU time.
+ * - Two threads that yield to each other count their yields.
+ * - With timer interrupts on, NSPINNERS threads that spin at once are
+ *   preempted and wait in the ready queue, and the time each one is charged
+ *   adds up to at least the time it spun.
+ * - thread_stats rejects invalid thread ids, and thread_stats_dump shows
+ *   threads that have exited but have not been waited for.
+ *****************************************************************************/
+
+#define SLEEP_USECS 50000
+#define NYIELDS 100
+#define NSPINNERS 8
+#define SPIN_USECS 20000
+
+static struct thread_stats stats[NSPINNERS];
+static int ndone;
+
+static void
+test_stats_sleeper(void *arg)
+{
+	thread_sleep_for(SLEEP_USECS);
+	assert(thread_stats(thread_id(), &stats[0]) == thread_id());
+}
+
+static void
+test_stats_yielder(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NYIELDS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	assert(thread_stats(thread_id(), &stats[(long)arg]) == thread_id());
+}
+
+static void
+test_stats_spinner(void *arg)
+{
+	spin(SPIN_USECS);
+	assert(thread_stats(thread_id(), &stats[(long)arg]) == thread_id());
+	__atomic_add_fetch(&ndone, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_stats_blocked(void)
+{
+	Tid child;
+
+	child = thread_create(test_stats_sleeper, NULL);
+	assert(thread_ret_ok(child));
+	thread_wait(child, NULL);
+	unintr_printf("sleeper: %lu us cpu, %lu us blocked, %lu sleeps\n",
+		      stats[0].cpu_ns / 1000, stats[0].blocked_ns / 1000,
+		      stats[0].sleeps);
+	assert(stats[0].blocked_ns >= SLEEP_USECS * 900UL);
+	assert(stats[0].cpu_ns < stats[0].blocked_ns);
+	assert(stats[0].sleeps >= 1);
+	assert(stats[0].preemptions == 0);
+}
+
+static void
+test_stats_yields(void)
+{
+	Tid child[2];
+	long i;
+
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_stats_yielder, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < 2; i++) {
+		thread_wait(child[i], NULL);
+	}
+	for (i = 0; i < 2; i++) {
+		unintr_printf("yielder %ld: %lu yields\n", i, stats[i].yields);
+		/* a yield with nothing else to run is not counted */
+		assert(stats[i].yields > 0 && stats[i].yields <= NYIELDS);
+		assert(stats[i].sleeps == 0);
+	}
+}
+
+static void
+test_stats_spin(void)
+{
+	Tid child[NSPINNERS];
+	unsigned long preemptions = 0, ready_ns = 0;
+	long i;
+
+	for (i = 0; i < NSPINNERS; i++) {
+		child[i] = thread_create(test_stats_spinner, (void *)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	while (__atomic_load_n(&ndone, __ATOMIC_RELAXED) < NSPINNERS) {
+		thread_yield(THREAD_ANY);
+	}
+	/* the spinners have exited, but their statistics are kept */
+	thread_stats_dump();
+	for (i = 0; i < NSPINNERS; i++) {
+		thread_wait(child[i], NULL);
+	}
+	for (i = 0; i < NSPINNERS; i++) {
+		assert(stats[i].cpu_ns + stats[i].ready_ns >=
+		       SPIN_USECS * 900UL);
+		preemptions += stats[i].preemptions;
+		ready_ns += stats[i].ready_ns;
+	}
+	unintr_printf("spinners: %lu preemptions, %lu us ready\n",
+		      preemptions, ready_ns / 1000);
+	assert(preemptions > 0);
+	assert(ready_ns > 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_stats self;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting stats test\n");
+	assert(thread_stats(THREAD_SELF, &self) == THREAD_INVALID);
+	assert(thread_stats(THREAD_MAX_THREADS, &self) == THREAD_INVALID);
+	assert(thread_stats(0, &self) == 0);
+	test_stats_blocked();
+	test_stats_yields();
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	test_stats_spin();
+	unintr_printf("stats test done\n");
+	return 0;
+}
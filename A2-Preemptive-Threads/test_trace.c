@@ -0,0 +1,183 @@
+#include <string.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Tests the scheduler event trace:
+ *
+ * - Threads that contend for a lock, yield, sleep and exit, and threads that
+ *   are preempted by timer interrupts, leave each kind of event in the
+ *   trace, and thread_trace_dump writes it as a Chrome trace event file.
+ * - NCHURN threads created and waited for, which record more events than
+ *   the ring holds, overwrite the oldest events, and the dump still writes
+ *   a well-formed file of the newest ones.
+ *****************************************************************************/
+
+#define NCHURN 40000
+#define SPIN_USECS 20000
+#define TRACE_MAX 65536		/* events in the trace ring */
+
+static struct lock *lock;
+static char path[] = "/tmp/test_trace.XXXXXX";
+
+static void
+test_trace_contender(void *arg)
+{
+	lock_acquire(lock);
+	thread_yield(THREAD_ANY);
+	lock_release(lock);
+	thread_sleep_for(1000);
+	thread_exit(42);
+}
+
+static void
+test_trace_spinner(void *arg)
+{
+	spin(SPIN_USECS);
+}
+
+static void
+test_trace_churner(void *arg)
+{
+}
+
+/* Reads the dumped trace into a malloc369'd string. */
+static char *
+read_trace(void)
+{
+	FILE *f;
+	long size;
+	char *buf;
+
+	f = fopen(path, "r");
+	assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	buf = malloc369(size + 1);
+	assert(fread(buf, 1, size, f) == size);
+	buf[size] = '\0';
+	fclose(f);
+	return buf;
+}
+
+static void
+check_has(const char *trace, const char *what)
+{
+	if (strstr(trace, what) == NULL) {
+		unintr_printf("trace test failed: no %s in the trace\n", what);
+		exit(1);
+	}
+}
+
+static void
+check_well_formed(const char *trace)
+{
+	size_t len = strlen(trace);
+
+	assert(strncmp(trace, "{\"traceEvents\":[", 16) == 0);
+	assert(len > 2 && strcmp(trace + len - 2, "}\n") == 0);
+}
+
+static void
+test_trace_events(void)
+{
+	Tid child[4];
+	char *trace;
+	int exit_code;
+	int n;
+	int i;
+
+	lock = lock_create();
+	lock_acquire(lock);
+	for (i = 0; i < 2; i++) {
+		child[i] = thread_create(test_trace_contender, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	thread_yield(THREAD_ANY);
+	lock_release(lock);
+	for (i = 0; i < 2; i++) {
+		assert(thread_wait(child[i], &exit_code) == child[i]);
+		assert(exit_code == 42);
+	}
+	lock_destroy(lock);
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+	for (i = 0; i < 4; i++) {
+		child[i] = thread_create(test_trace_spinner, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < 4; i++) {
+		thread_wait(child[i], NULL);
+	}
+
+	n = thread_trace_dump(path);
+	unintr_printf("%d events\n", n);
+	assert(n > 0);
+	trace = read_trace();
+	check_well_formed(trace);
+	check_has(trace, "\"name\":\"create\"");
+	check_has(trace, "\"name\":\"lock_contend\"");
+	check_has(trace, "\"name\":\"wakeup\"");
+	check_has(trace, "\"name\":\"tick\"");
+	check_has(trace, "\"switch\":\"yield\"");
+	check_has(trace, "\"switch\":\"sleep\"");
+	check_has(trace, "\"switch\":\"preempt\"");
+	check_has(trace, "\"switch\":\"exit\",\"exit\":42");
+	free369(trace);
+}
+
+static void
+test_trace_wrap(void)
+{
+	Tid child;
+	char *trace;
+	int n;
+	int i;
+
+	/* each one is at least created, switched to, and exits */
+	for (i = 0; i < NCHURN; i++) {
+		child = thread_create(test_trace_churner, NULL);
+		assert(thread_ret_ok(child));
+		thread_wait(child, NULL);
+	}
+	n = thread_trace_dump(path);
+	unintr_printf("%d events after %d threads\n", n, NCHURN);
+	assert(n > TRACE_MAX / 2 && n <= TRACE_MAX);
+	trace = read_trace();
+	check_well_formed(trace);
+	free369(trace);
+}
+
+int
+main(int argc, char **argv)
+{
+	int fd;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting trace test\n");
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	assert(thread_trace_dump("/nonexistent/trace.json") == -1);
+	assert(thread_trace_enable(1) == 0);
+	test_trace_events();
+	test_trace_wrap();
+	assert(thread_trace_enable(0) == 1);
+	unlink(path);
+	unintr_printf("trace test done\n");
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Runs threads on NWORKERS kernel worker threads (M:N mode). Each thread
+ * increments a shared counter under a lock, yielding inside the critical
+ * section, and notes which kernel thread it ran on. At the end the counter
+ * must be exact, and the threads must have run on more than one worker.
+ *****************************************************************************/
+
+#define NWORKERS 4
+#define NCHILDREN 32
+#define NINCREMENTS 200
+
+static struct lock *lock;
+static long counter;
+static pid_t ktids[NWORKERS];
+static int nktids;
+
+/* Remembers the kernel thread we are running on. */
+static void
+note_worker(void)
+{
+	pid_t ktid = gettid();
+	int enabled;
+	int i;
+
+	enabled = interrupts_off();
+	for (i = 0; i < nktids; i++) {
+		if (ktids[i] == ktid) {
+			break;
+		}
+	}
+	if (i == nktids) {
+		assert(nktids < NWORKERS);
+		ktids[nktids++] = ktid;
+	}
+	interrupts_set(enabled);
+}
+
+static void
+test_workers_thread(void *arg)
+{
+	long old;
+	int i;
+
+	for (i = 0; i < NINCREMENTS; i++) {
+		lock_acquire(lock);
+		old = counter;
+		thread_yield(THREAD_ANY);
+		counter = old + 1;
+		lock_release(lock);
+		note_worker();
+		spin(10);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	Tid child[NCHILDREN];
+	int exit_code;
+	Tid ret;
+	int i;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library with NWORKERS kernel threads */
+	thread_init_workers(NWORKERS);
+
+	/* Register interrupt handler & start timer interrupts.
+	 * Don't show handler output
+	 */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting workers test\n");
+	lock = lock_create();
+	for (i = 0; i < NCHILDREN; i++) {
+		child[i] = thread_create(test_workers_thread, NULL);
+		assert(thread_ret_ok(child[i]));
+	}
+	for (i = 0; i < NCHILDREN; i++) {
+		ret = thread_wait(child[i], &exit_code);
+		assert(ret == child[i]);
+		assert(exit_code == 0);
+	}
+	lock_destroy(lock);
+
+	unintr_printf("%ld increments on %d kernel threads\n", counter, nktids);
+	if (counter != NCHILDREN * NINCREMENTS) {
+		unintr_printf("workers test failed: counter is %ld, expected "
+			      "%d\n", counter, NCHILDREN * NINCREMENTS);
+		return 1;
+	}
+	if (nktids < 2) {
+		unintr_printf("workers test failed: threads ran on a single "
+			      "worker\n");
+		return 1;
+	}
+	unintr_printf("workers test done\n");
+	return 0;
+}
@@ -1,35 +1,77 @@
 #include <assert.h>
 #include "malloc369.h"
 #include <stdlib.h>
-#include <ucontext.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <x86intrin.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <pthread.h>
 #include "thread.h"
 #include "interrupt.h"
+#include "context.h"
 
-/* This is the wait queue structure, needed for Assignment 2. */ 
-struct waiting_thread{
-	Tid data;
-	struct waiting_thread* next;
+/* The ready queue is an intrusive doubly-linked list threaded through the
+ * thread control blocks, so pushing, popping and unlinking a thread from the
+ * middle of the queue (directed yield, kill) are all O(1).
+ */
+struct thread_queue {
+	struct thread* head;
+	struct thread* tail;
+	int size;
+	/* for a ready queue, the worker it belongs to and its priority level */
+	struct worker* worker;
+	int level;
 };
 
+/* This is the wait queue structure, needed for Assignment 2. A thread sleeps
+ * on at most one wait queue, and is never on a ready queue at the same time,
+ * so a wait queue reuses the run queue links in the thread control block and
+ * sleeping and waking up never allocate. */
 struct wait_queue {
-	struct waiting_thread* head;
-	struct waiting_thread* tail;
-	int size;
-	int id;
+	struct thread_queue threads;
 };
 
-/* For Assignment 1, you will need a queue structure to keep track of the 
- * runnable threads. You can use the tutorial 1 queue implementation if you 
- * like. You will probably find in Assignment 2 that the operations needed
- * for the wait_queue are the same as those needed for the ready_queue.
- */
+/* Timer wheel links of a thread, see the timer wheel below. */
+struct thread_timer {
+	struct thread* next;
+	struct thread* prev;
+	struct thread** slot;	/* wheel slot, NULL when no timer is pending */
+	unsigned long expires;	/* in wheel ticks */
+};
+
+/* Scheduling state of a thread, for its statistics. */
+enum acct_state {
+	ACCT_RUNNING,
+	ACCT_READY,
+	ACCT_BLOCKED,
+	ACCT_EXITED
+};
+
+/* Scheduling statistics of a thread, see thread_stats. Times are in time
+ * stamp counter cycles, and are converted to nanoseconds when read. */
+struct thread_acct {
+	enum acct_state state;
+	unsigned long since;		/* when the thread entered state */
+	unsigned long cycles[ACCT_EXITED];	/* per state, not counting since */
+	unsigned long yields;
+	unsigned long preemptions;
+	unsigned long sleeps;
+};
 
 /* This is the thread control block. */
 struct thread {
-	ucontext_t context;
+	struct context context;
 	Tid Tid;
 	int* stack_addr;
+	size_t stack_size;
 	bool killed;
 	bool sleeping;
 	struct wait_queue* wq;
@@ -37,20 +79,378 @@ struct thread {
 	int exit;
 	Tid parent;
 	bool stack_freed;
+	/* scheduling level, from THREAD_PRIO_HIGHEST to THREAD_PRIO_LOWEST. prio
+	 * moves between base_prio and THREAD_PRIO_LOWEST as the thread is
+	 * demoted and boosted */
+	int base_prio;
+	int prio;
+	/* the boost_epoch that prio last caught up with (see boost_sync), and
+	 * while the thread is ready, the level a boost returns it to, which
+	 * picks its list in the worker's ready_queue */
+	unsigned long boost_seen;
+	int ready_floor;
+	/* priority inherited from threads waiting for the locks this thread
+	 * holds (locks_held), or THREAD_PRIO_LEVELS, and the lock it waits for
+	 * itself, if any (see pi_propagate) */
+	int pi_prio;
+	struct lock* locks_held;
+	struct lock* waiting_lock;
+	/* virtual runtime, weight, and place in its worker's fair_heap while
+	 * it is ready under THREAD_SCHED_FAIR */
+	unsigned long vruntime;
+	int weight;
+	int heap_index;
+	/* when the thread was last made ready, to break ties */
+	unsigned long ready_seq;
+	/* set while a preempted thread waits to resume on the same worker */
+	bool pinned;
+	/* a lock, rwlock or semaphore this thread sleeps on, which may be
+	 * handed to it before it runs, and the function that passes it on if
+	 * the thread exits first (see handoff_sleep) */
+	void* handoff_obj;
+	void (*handoff_abandon)(void *obj, Tid tid);
+	/* pending timeout of thread_sleep_for or a _timeout call, and whether
+	 * the last one expired */
+	struct thread_timer timer;
+	bool timed_out;
+	/* scheduling statistics */
+	struct thread_acct acct;
+	/* errno of the thread while it is switched out */
+	int saved_errno;
+	/* set while the thread sleeps on an fd's wait queue */
+	bool io_waiting;
+	/* message a thread blocked in chan_send or chan_recv sends or was
+	 * handed, and whether that happened (see struct chan) */
+	void* chan_msg;
+	bool chan_done;
+	/* see struct thread_attr */
+	char name[THREAD_NAME_LEN];
+	/* run queue links, queue is NULL when the thread is not on a queue */
+	struct thread* next;
+	struct thread* prev;
+	struct thread_queue* queue;
+};
+
+/* A worker is a kernel thread that runs user-level threads. There is one
+ * worker, the initial kernel thread, unless thread_init_workers starts more
+ * (M:N mode). Each worker has its own ready queue, and a worker whose ready
+ * queue is empty steals threads from the others, or waits on idle_seq.
+ *
+ * In M:N mode all library state is protected by the scheduler lock, which
+ * interrupts_off takes (see interrupt.c). A thread may resume on a different
+ * worker after it blocks or yields, so the running worker is always looked
+ * up with current_worker() rather than cached across a context switch. A
+ * thread that is preempted may have been stopped in the middle of using
+ * thread-local state of its worker (its own or libc's), so it is pinned and
+ * only resumes on the same worker.
+ */
+struct worker {
+	int id;
+	Tid running;			/* -300 while the worker is idle */
+	/* ready_queue[level][floor] holds the threads ready at level that a
+	 * boost returns to level floor (see priority_boost) */
+	struct thread_queue ready_queue[THREAD_PRIO_LEVELS][THREAD_PRIO_LEVELS];
+	unsigned int ready_levels;	/* bit i is set when level i is non-empty */
+	/* bit f of ready_floors[i] is set when ready_queue[i][f] is non-empty */
+	unsigned int ready_floors[THREAD_PRIO_LEVELS];
+	/* the ready queue under THREAD_SCHED_FAIR: a min-heap of fair_queue.size
+	 * threads, which point their queue at fair_queue */
+	struct thread_queue fair_queue;
+	struct thread** fair_heap;
+	unsigned long min_vruntime;
+	struct context idle_context;	/* where the worker waits for work */
+	int* idle_stack;
+	pthread_t pthread;
+	volatile pid_t ktid;		/* kernel thread id, for its timer */
+};
+
+struct worker workers[THREAD_MAX_WORKERS];
+int num_workers = 1;
+int num_ready = 0;		/* threads on all ready queues */
+int num_idle_workers = 0;
+int idle_seq = 0;		/* futex word that idle workers wait on */
+static __thread struct worker *self_worker;
+
+/* Each worker's ready queue is a multilevel feedback queue: one FIFO per
+ * priority level, and the worker runs the first thread of the highest
+ * non-empty level.
+ * A thread that is preempted by the timer has used its whole quantum and
+ * drops a level, a thread that blocks in thread_sleep rises a level (but not
+ * above its base priority), so CPU-bound threads sink below interactive ones.
+ * Every PRIO_BOOST_TICKS timer ticks all threads return to their base level,
+ * so that sunk threads cannot be starved forever.
+ * A boost must not visit every thread, as it runs in the timer interrupt,
+ * so each level is split into one list per level a boost returns its
+ * threads to (the thread's floor), and the boost splices whole lists. The
+ * threads that are not ready catch up with boost_epoch when their level is
+ * next looked at.
+ */
+#define PRIO_BOOST_TICKS 100
+
+int ticks_since_boost = 0;
+unsigned long boost_epoch = 0;	/* boosts so far */
+
+/* Under THREAD_SCHED_FAIR each worker's ready threads are kept instead on a
+ * binary min-heap, fair_heap, ordered by virtual runtime: the time stamp
+ * counter cycles a thread has run, scaled by THREAD_WEIGHT_DEFAULT / weight,
+ * so that a thread of twice the weight ages half as fast. The worker runs
+ * the thread with the least, and the timer switches to it as soon as the
+ * running thread has more. vruntimes are compared by their difference, so
+ * they may wrap around, and threads with the same vruntime run in the order
+ * they were made ready.
+ * min_vruntime follows the least vruntime on the worker and never goes back.
+ * A new thread starts at it, and a thread made ready is moved up to no more
+ * than FAIR_SLEEPER_USECS of CPU time behind it, so a thread that slept gets
+ * a head start, but not all the CPU time it missed. A thread stolen by
+ * another worker keeps its distance from min_vruntime.
+ */
+#define FAIR_SLEEPER_USECS 1000
+
+bool sched_fair = false;
+unsigned long fair_credit = 0;	/* FAIR_SLEEPER_USECS in cycles */
+unsigned long ready_pushes = 0;	/* threads made ready so far */
+
+/* Timed sleeps (thread_sleep_for, lock_acquire_timeout, cv_wait_timeout) are
+ * kept on a hierarchical timer wheel: WHEEL_LEVELS levels of WHEEL_SLOTS
+ * slots, where a slot of level l covers WHEEL_SLOTS^l ticks of
+ * WHEEL_TICK_USECS. A timer goes to the lowest level whose range covers its
+ * expiry, so arming and cancelling are O(1). When level 0 wraps around, the
+ * next slot of level 1 is moved down into level 0, and so on up the levels.
+ * The wheel is advanced from the timer interrupt (thread_preempt), from
+ * thread_yield, and by idle workers, which sleep in the kernel until the next
+ * timer can expire, so threads in timed sleeps use no CPU.
+ */
+#define WHEEL_TICK_USECS 100
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+struct thread* wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+unsigned long wheel_tick = 0;	/* the next tick to expire */
+int num_timers = 0;		/* pending timers */
+
+/* Threads waiting for file descriptors (thread_read, thread_write,
+ * thread_accept) sleep on the readers or writers wait queue of their fd, and
+ * the fd is registered, edge-triggered, with the io_epfd epoll instance. A
+ * worker that runs out of threads waits in epoll_wait instead of on idle_seq
+ * while any thread waits for I/O, and other workers wake it through the
+ * io_wakefd eventfd. The instance is also polled every IO_POLL_TICKS timer
+ * ticks, so I/O is noticed while CPU-bound threads keep the ready queues
+ * busy. The wait queues of the fds live in segments of IO_SEGMENT fds, each
+ * mmap'd the first time an fd in it waits, like the thread table.
+ */
+#define IO_POLL_TICKS 4
+#define IO_EVENTS 64
+#define IO_SEGMENT_BITS 10
+#define IO_SEGMENT (1 << IO_SEGMENT_BITS)
+#define IO_SEGMENT_MASK (IO_SEGMENT - 1)
+#define IO_MAX_FDS (1 << 20)
+
+struct io_fd {
+	struct wait_queue readers;
+	struct wait_queue writers;
+};
+
+struct io_fd* io_segments[IO_MAX_FDS / IO_SEGMENT];
+int io_epfd = -1;
+int io_wakefd = -1;
+int num_io_waiters = 0;		/* threads sleeping on an fd */
+bool io_poller_idle = false;	/* an idle worker is in epoll_wait */
+int io_ticks = 0;
+
+/* Address-keyed waiting (thread_park). Threads parked on an address sleep
+ * on that address's park_queue, found by hashing the address into one of
+ * PARK_BUCKETS buckets and walking the bucket's short chain of queues, so
+ * waking the threads of one address never walks those of another. A queue
+ * exists only while threads are parked on its address; emptied queues go on
+ * a freelist, so parking only allocates when more addresses than ever
+ * before have threads parked on them at once. */
+#define PARK_BUCKET_BITS 10
+#define PARK_BUCKETS (1 << PARK_BUCKET_BITS)
+
+struct park_queue {
+	int* addr;
+	struct wait_queue wq;
+	struct park_queue* next;	/* in its bucket, or on the freelist */
+};
+
+struct park_queue* park_buckets[PARK_BUCKETS];
+struct park_queue* park_free = NULL;
+
+/* The thread table. TCB pointers live in segments of TCB_SEGMENT slots, each
+ * mmap'd the first time an id in it is handed out, so the table only costs
+ * memory for the ids that have been used, up to the max_threads ceiling (see
+ * thread_set_max_threads). Looking up a thread is two array indexes.
+ *
+ * The slot of a free id holds the next id on the stack of free ids. Ids are
+ * recycled LIFO so that a new thread reuses the most recently reaped id,
+ * whose TCB slot is still cache-hot; ids from next_tid up have never been
+ * handed out. */
+#define TCB_SEGMENT_BITS 10
+#define TCB_SEGMENT (1 << TCB_SEGMENT_BITS)
+#define TCB_SEGMENT_MASK (TCB_SEGMENT - 1)
+#define TCB_SEGMENTS (THREAD_MAX_THREADS_LIMIT / TCB_SEGMENT)
+
+struct tcb_slot {
+	struct thread* thread;
+	Tid next_free;
 };
 
-Tid running_thread;
-Tid ready_queue[THREAD_MAX_THREADS];
-Tid available_threads[THREAD_MAX_THREADS];
-struct thread* created_threads[THREAD_MAX_THREADS];
-struct wait_queue* all_wait_queues[THREAD_MAX_THREADS*THREAD_MAX_THREADS];
+struct tcb_slot* tcb_segments[TCB_SEGMENTS];
+int max_threads = THREAD_MAX_THREADS;
+Tid next_tid = 0;		/* ids below next_tid have been handed out */
+Tid free_tids = (Tid) -300;	/* top of the stack of free ids */
+
+
+/* Thread stacks are carved out of slabs of STACK_SLAB_BYTES, each mmap'd
+ * once, with a guard page directly below every stack so that an overflow
+ * faults instead of silently corrupting the stack below. Where the kernel
+ * supports MADV_GUARD_INSTALL (Linux 6.13) the guard pages do not split the
+ * slab's mapping; otherwise they are mprotect'd, which costs two mappings per
+ * stack and limits the number of threads to about vm.max_map_count / 2.
+ *
+ * Stacks come in STACK_CLASSES size classes, THREAD_STACK_FLOOR << c bytes
+ * for class c, and each class has slabs of its own. Stacks of reaped threads
+ * are kept on their class's freelist (linked through the first word of each
+ * stack) and handed to the next thread created with a stack of that class.
+ * Beyond STACK_POOL_MAX cached stacks in a class, a freed stack's pages
+ * other than the lowest are given back to the kernel, so a burst of threads
+ * does not keep its memory after it exits. A stack larger than the largest
+ * class is mmap'd on its own and unmapped once its thread is reaped.
+ */
+#define STACK_POOL_MAX 64
+#define STACK_SLAB_BYTES (2 << 20)
+#define STACK_CLASSES 6		/* up to 512KB */
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+struct stack_class {
+	void* pool;
+	int pool_size;
+	char* slab;		/* next unused stack in the current slab */
+	int slab_left;
+};
 
+struct stack_class stack_classes[STACK_CLASSES];
+bool stack_guard_mprotect = false;
 
 int num_threads_created = 0;
+/* time stamp counter and clock at thread_init, to convert cycles to ns */
+unsigned long acct_tsc0;
+long acct_ns0;
+
+/* Scheduler event trace, see thread_trace_enable. Events go into a ring of
+ * TRACE_EVENTS slots that overwrites the oldest ones. A writer claims a slot
+ * with an atomic increment of trace_head and publishes it by storing its
+ * sequence number last, so recording never blocks or allocates, and is safe
+ * from the interrupt handler and from several workers at once. */
+#define TRACE_EVENTS (1 << 16)
+#define TRACE_MASK (TRACE_EVENTS - 1)
+
+enum trace_type {
+	TRACE_CREATE,		/* tid created other */
+	TRACE_YIELD,		/* tid switched to other ... */
+	TRACE_PREEMPT,		/* ... because its quantum was up */
+	TRACE_SLEEP,		/* ... because it went to sleep */
+	TRACE_EXIT,		/* ... because it exited with code arg */
+	TRACE_RUN,		/* an idle worker switched to tid */
+	TRACE_WAKEUP,		/* other woke tid up */
+	TRACE_TICK,		/* timer interrupt while tid ran */
+	TRACE_LOCK_CONTEND	/* tid found lock arg held by other */
+};
+
+struct trace_event {
+	unsigned long seq;	/* index in the trace plus one, once written */
+	unsigned long tsc;
+	enum trace_type type;
+	int worker;
+	Tid tid;
+	Tid other;
+	long arg;
+};
+
+struct trace_event trace_ring[TRACE_EVENTS];
+unsigned long trace_head = 0;	/* events recorded so far */
+bool trace_on = false;
+/* THREAD_LOCK_PROFILE makes every lock a LOCK_PROFILE lock */
+bool lock_profile_all = false;
 bool returning_from_exit = false;
 int* zombie_stack_addr = NULL;
 Tid zombie_tid = (Tid) -300;
-int num_wait_queues = 0;
+
+void 
+append_to_available(Tid val);
+
+Tid
+remove_from_available();
+
+struct thread *
+get_thread(Tid tid);
+
+void
+set_thread(Tid tid, struct thread *t);
+
+void
+start_workers(int nworkers);
+
+void
+thread_set_name(struct thread *t, const char *name);
+
+void
+wakeup_thread(struct thread *t);
+
+void
+worker_init_idle(struct worker *w);
+
+void
+timer_advance();
+
+long
+timer_next_ns();
+
+struct thread;
+
+void
+switch_to(struct thread *cur, struct thread *next);
+
+void
+acct_init(struct thread *t, enum acct_state state);
+
+void
+acct_enter(struct thread *t, enum acct_state state, unsigned long now);
+
+double
+acct_ns_per_cycle();
+
+void
+fair_credit_update();
+
+void
+fair_update_min(struct worker *w);
+
+void
+pi_leave(struct lock *lock);
+
+long
+clock_ns(void);
+
+void
+trace_record(enum trace_type type, Tid tid, Tid other, long arg);
+
+void
+io_poll(struct timespec *timeout, bool idle);
+
+/* Returns the worker we are running on. This is a real call (noipa), so its
+ * result is never reused across a context switch, after which the calling
+ * thread may be running on another worker. */
+__attribute__((noipa)) struct worker *
+current_worker(){
+	return self_worker;
+}
+
+#define running_thread (current_worker()->running)
 
 /**************************************************************************
  * Assignment 1: Refer to thread.h for the detailed descriptions of the six
@@ -60,15 +460,71 @@ int num_wait_queues = 0;
 void
 thread_init(void)
 {
-	
+	/* THREAD_WORKERS=n runs an unmodified program in M:N mode */
+	char *nworkers = getenv("THREAD_WORKERS");
+	/* and THREAD_MAX_THREADS=n lets it have up to n threads */
+	char *nthreads = getenv("THREAD_MAX_THREADS");
+	if (nthreads != NULL){
+		thread_set_max_threads(atoi(nthreads));
+	}
+	/* and THREAD_LOCK_PROFILE=1 profiles all of its locks */
+	lock_profile_all = getenv("THREAD_LOCK_PROFILE") != NULL;
+	thread_init_workers(nworkers != NULL ? atoi(nworkers) : 1);
+	/* and THREAD_SCHED=fair schedules it by weight */
+	char *sched = getenv("THREAD_SCHED");
+	if (sched != NULL && strcmp(sched, "fair") == 0){
+		thread_set_sched(THREAD_SCHED_FAIR);
+	}
+}
+
+void
+thread_init_workers(int nworkers)
+{
+	if (nworkers < 1){
+		nworkers = 1;
+	} else if (nworkers > THREAD_MAX_WORKERS){
+		nworkers = THREAD_MAX_WORKERS;
+	}
+	for (int i = 0; i < THREAD_MAX_WORKERS; i++){
+		struct worker *w = &workers[i];
+		w->id = i;
+		w->running = (Tid)-300;
+		for (int level = 0; level < THREAD_PRIO_LEVELS; level++){
+			for (int floor = 0; floor < THREAD_PRIO_LEVELS; floor++){
+				struct thread_queue *q = &w->ready_queue[level][floor];
+				q->head = NULL;
+				q->tail = NULL;
+				q->size = 0;
+				q->worker = w;
+				q->level = level;
+			}
+			w->ready_floors[level] = 0;
+		}
+		w->ready_levels = 0;
+		w->fair_queue.head = NULL;
+		w->fair_queue.tail = NULL;
+		w->fair_queue.size = 0;
+		w->fair_queue.worker = w;
+		w->fair_queue.level = THREAD_PRIO_LEVELS;
+		w->fair_heap = NULL;
+		w->min_vruntime = 0;
+		w->idle_stack = NULL;
+		w->ktid = 0;
+	}
+	self_worker = &workers[0];
+	num_workers = 1;
+	num_ready = 0;
+	/* a thread that goes to sleep with nothing else ready switches to
+	 * the idle loop, which waits for timers to expire */
+	worker_init_idle(&workers[0]);
+
 	/* Add necessary initialization for your threads library here. */
         /* Initialize the thread control block for the first thread */
 	/* 1. initialize thread_control_block*/
 	/*what should stackPointer be for this thread? Null?*/
+	/* its context is filled in when it first switches to another thread */
 	struct thread* init_thread = malloc369(sizeof(struct thread));
 
-	getcontext(&(init_thread->context));
-
     init_thread->Tid = 0;
 	init_thread->killed = false;
 	++ num_threads_created;
@@ -77,23 +533,46 @@ thread_init(void)
 	init_thread -> waiting_on = -300;
 	init_thread -> exit = -300;
 	init_thread->parent = 0;
+	/* the initial thread runs on the process stack */
+	init_thread->stack_addr = NULL;
+	init_thread->stack_size = 0;
+	thread_set_name(init_thread, "main");
 	init_thread->stack_freed = false;
+	init_thread->next = NULL;
+	init_thread->prev = NULL;
+	init_thread->queue = NULL;
+	init_thread->handoff_obj = NULL;
+	init_thread->handoff_abandon = NULL;
+	init_thread->timer.slot = NULL;
+	init_thread->timed_out = false;
+	init_thread->io_waiting = false;
+	init_thread->chan_msg = NULL;
+	init_thread->chan_done = false;
+	acct_tsc0 = __rdtsc();
+	acct_ns0 = clock_ns();
+	acct_init(init_thread, ACCT_RUNNING);
+	init_thread->base_prio = THREAD_PRIO_DEFAULT;
+	init_thread->prio = THREAD_PRIO_DEFAULT;
+	init_thread->pi_prio = THREAD_PRIO_LEVELS;
+	init_thread->locks_held = NULL;
+	init_thread->waiting_lock = NULL;
+	init_thread->vruntime = 0;
+	init_thread->weight = THREAD_WEIGHT_DEFAULT;
+	init_thread->heap_index = -1;
+	init_thread->pinned = false;
 
 	/* 2. initialize the ready_queue*/
 	running_thread = (Tid) 0;
-	for (int i = 0; i < THREAD_MAX_THREADS-1; i++) {
-        available_threads[i] = (Tid) (i+1);
-    }
-	available_threads[THREAD_MAX_THREADS-1] = (Tid) -300;
-
-	created_threads[0] = init_thread;
-    for (int i = 0; i<THREAD_MAX_THREADS; ++i){
-        ready_queue[i] = (Tid) -300;
-    }
-	for (int i = 1; i < THREAD_MAX_THREADS-1; i++) {
-        created_threads[i] = NULL;
-    }
-
+	/* ids are first handed out in increasing order */
+	next_tid = 0;
+	free_tids = (Tid) -300;
+	Tid init_tid = remove_from_available();
+	assert(init_tid == 0);
+	set_thread(init_tid, init_thread);
+
+	if (nworkers > 1){
+		start_workers(nworkers);
+	}
 }
 
 Tid
@@ -124,637 +603,3324 @@ thread_stub(void (*thread_main)(void *), void *arg)
         thread_exit(0);
 }
 
-void remove_from_available(){
-	for (int i = 0; i < THREAD_MAX_THREADS -1; ++i) {
-        available_threads[i] = available_threads[i + 1];
-    }
-	available_threads[THREAD_MAX_THREADS-1] = (Tid) -300;
-	
+/* Returns the TCB slot of id tid, which must have been handed out. */
+struct tcb_slot *
+tcb_slot(Tid tid){
+	assert(tid >= 0 && tid < next_tid);
+	return &tcb_segments[tid >> TCB_SEGMENT_BITS][tid & TCB_SEGMENT_MASK];
 }
 
-void add_to_queue_tail(Tid id){
-    for (int i = 0; i < THREAD_MAX_THREADS; ++i){
-        if (ready_queue[i] == (Tid) -300) {
-            ready_queue[i] = id;
-            break;
-        }
-    }
+/* Returns the TCB of thread tid, or NULL if there is no such thread. */
+struct thread *
+get_thread(Tid tid){
+	if (tid < 0 || tid >= next_tid){
+		return NULL;
+	}
+	return tcb_segments[tid >> TCB_SEGMENT_BITS][tid & TCB_SEGMENT_MASK].thread;
 }
 
-Tid
-thread_create(void (*fn) (void *), void *parg)
-{
-	int e = interrupts_off();
-	// if no more space for another thread -> THREAD_NO_MORE
-	// if created_threads[THREAD_MAX_THREADS -1] != -1
-	if(num_threads_created == THREAD_MAX_THREADS){
-		interrupts_set(e);
-		return THREAD_NOMORE;}
-	++num_threads_created;
-
-	// turns out we do have space to create a thread
-	struct thread* create_thread = malloc369(sizeof(struct thread));
-
-	assert (!interrupts_enabled());
-	getcontext(&(create_thread->context));
-	
-	// what is the tid of our thread?
-	Tid create_thread_tid = available_threads[0];
-	remove_from_available();
-	create_thread->Tid = create_thread_tid;
-	/* now we have to adjust some values in our context before*/
-	// 1. rip has to point to stub function
-	create_thread->context.uc_mcontext.gregs[REG_RIP] = (unsigned long) &thread_stub;
-	// 2. save argument registers in context, these registers will hold the two arguments passed above
-	create_thread->context.uc_mcontext.gregs[REG_RDI]= (unsigned long) fn;
-	create_thread->context.uc_mcontext.gregs[REG_RSI]= (unsigned long) parg;
-	// 3. need to allocate a stack using malloc
-	int *lower_limit = malloc369(THREAD_MIN_STACK);
-	if (lower_limit == NULL) {
-		interrupts_set(e);
-		return THREAD_NOMEMORY;}
-	create_thread->stack_addr = lower_limit;
-	create_thread->killed = false;
-	create_thread -> sleeping = false;
-	create_thread->wq = NULL;
-	create_thread -> waiting_on = -300;
-	create_thread -> exit = -300;
-	create_thread ->parent = running_thread;
-	create_thread->stack_freed = false;
-	// align (unsigned long)lower_limit) + (unsigned long) (THREAD_MIN_STACK) first 
-	unsigned long upper_limit = ((unsigned long)lower_limit) + (unsigned long) (THREAD_MIN_STACK) - (unsigned long) 8;
-	// 4. change the saved stack pointer register in the context to point to the top of the new stack
-	create_thread->context.uc_mcontext.gregs[REG_RSP] = (unsigned long) upper_limit;
-
-	// add this thread to created_threads
-	created_threads[(int)create_thread_tid] = create_thread;
-	// add this thread to ready_queue
-	add_to_queue_tail(create_thread_tid);
-	// return tid of created thread
-	interrupts_set(e);
-	return create_thread_tid;
+void
+set_thread(Tid tid, struct thread *t){
+	tcb_slot(tid)->thread = t;
+}
 
+/* Returns whether remove_from_available can hand out an id. */
+bool
+tid_available(){
+	return free_tids != (Tid) -300 || next_tid < max_threads;
 }
 
-void 
-append_to_available(Tid val){
-	for (int i=0; i<THREAD_MAX_THREADS; ++i){
-		if (available_threads[i] == (Tid)-300){
-			available_threads[i] = val;
-			break;
+/* Returns a free id, or -300 if the table segment for a new id cannot be
+ * allocated. */
+Tid
+remove_from_available(){
+	assert(tid_available());
+	if (free_tids != (Tid) -300){
+		Tid tid = free_tids;
+		free_tids = tcb_slot(tid)->next_free;
+		return tid;
+	}
+	struct tcb_slot **seg = &tcb_segments[next_tid >> TCB_SEGMENT_BITS];
+	if (*seg == NULL){
+		void *slots = mmap(NULL, TCB_SEGMENT * sizeof(struct tcb_slot),
+				   PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (slots == MAP_FAILED){
+			return (Tid) -300;
 		}
+		*seg = slots;
 	}
+	return next_tid++;
 }
 
 void 
-thread_create_zombie(Tid thread){
-    zombie_tid = thread;
-    zombie_stack_addr = created_threads[(int)thread]->stack_addr;
+append_to_available(Tid val){
+	struct tcb_slot *slot = tcb_slot(val);
+	assert(slot->thread == NULL);
+	slot->next_free = free_tids;
+	free_tids = val;
 }
 
-void 
-cleanup_before_zombifying(Tid zombie){
-	/* CLEANUP WAITS BEFORE EXITING*/
-	struct thread* zombie_thread = created_threads[(int)zombie];
-	if (zombie_thread ->waiting_on != -300){
-		Tid waiting_for = zombie_thread ->waiting_on;
-		created_threads[waiting_for] -> wq -> head = NULL;
-		created_threads[waiting_for] -> wq -> tail = NULL;
-		created_threads[waiting_for] -> wq -> size = 0;
-	}
-	if (zombie_thread ->wq != NULL && zombie_thread->wq->head != NULL){
-		thread_wakeup(zombie_thread->wq, false);
+int
+thread_set_max_threads(int max){
+	int e = interrupts_off();
+	int ret = max_threads;
+	if (max < 1 || max > THREAD_MAX_THREADS_LIMIT || max < next_tid){
+		ret = THREAD_INVALID;
+	} else {
+		max_threads = max;
 	}
+	interrupts_set(e);
+	return ret;
 }
 
-void 
-thread_cleanup_zombie(bool freed_stack){
-	append_to_available(zombie_tid);
-    assert(zombie_tid != (Tid)-300);
-	wait_queue_destroy(created_threads[(int) zombie_tid]->wq);
-	created_threads[(int) zombie_tid]->wq = NULL;
-	assert(created_threads[(int) zombie_tid]->wq == NULL);
-
-	if (!freed_stack){
-		free369(created_threads[(int)zombie_tid]->stack_addr);
-		created_threads[(int)zombie_tid]->stack_addr = NULL;
+void
+queue_push_tail(struct thread_queue *q, struct thread *t){
+	assert(t->queue == NULL);
+	t->next = NULL;
+	t->prev = q->tail;
+	if (q->tail == NULL){
+		q->head = t;
+	} else {
+		q->tail->next = t;
 	}
-	assert (created_threads[(int)zombie_tid]->stack_addr == NULL);
-
-    free369(created_threads[(int) zombie_tid]);
-    created_threads[(int) zombie_tid] = NULL;
-    zombie_tid = (Tid)-300;
+	q->tail = t;
+	t->queue = q;
+	++q->size;
+}
 
-    if (zombie_stack_addr != NULL){
-		free369(zombie_stack_addr);
-    	zombie_stack_addr = NULL;
+/* Moves every thread on src to the tail of dst, leaving their queue
+ * pointers as they were. */
+void
+queue_splice(struct thread_queue *dst, struct thread_queue *src){
+	if (src->head == NULL){
+		return;
 	}
-	
+	if (dst->tail == NULL){
+		dst->head = src->head;
+	} else {
+		dst->tail->next = src->head;
+		src->head->prev = dst->tail;
+	}
+	dst->tail = src->tail;
+	dst->size += src->size;
+	src->head = NULL;
+	src->tail = NULL;
+	src->size = 0;
 }
 
-
+/* Takes t off q, which may not be t->queue if q was spliced. */
 void
-thread_routine_cleanup(){
-	// check if running thread is exited
-	if (zombie_tid != -300){ 
-		//cleanup stack pointer
-		free369(created_threads[(int)zombie_tid]->stack_addr);
-		created_threads[(int)zombie_tid]->stack_addr = NULL;
-		created_threads[(int)zombie_tid]->stack_freed = true;
-		zombie_tid = (Tid)-300;
-		zombie_stack_addr = NULL;
+queue_unlink(struct thread_queue *q, struct thread *t){
+	if (t->prev == NULL){
+		q->head = t->next;
+	} else {
+		t->prev->next = t->next;
 	}
-	interrupts_off();
-    if (created_threads[(int) running_thread]->killed){
-        thread_exit(-SIGKILL);
-    }
+	if (t->next == NULL){
+		q->tail = t->prev;
+	} else {
+		t->next->prev = t->prev;
+	}
+	t->next = NULL;
+	t->prev = NULL;
+	--q->size;
 }
 
-Tid 
-find_index_in_queue(Tid want_tid){
-    for (int i = 0; i < THREAD_MAX_THREADS; ++i) {
-        if (ready_queue[i] == want_tid) {
-            return i; // Return the index if the target is found
-        }
-    }
-    return -1; 
+void
+queue_remove(struct thread *t){
+	assert(t->queue != NULL);
+	queue_unlink(t->queue, t);
+	t->queue = NULL;
 }
 
-void 
-remove_from_queue(int index) {
+struct thread *
+queue_pop_head(struct thread_queue *q){
+	struct thread *t = q->head;
+	if (t != NULL){
+		queue_remove(t);
+	}
+	return t;
+}
 
-    for (int i = index; i < THREAD_MAX_THREADS -1; ++i) {
-        ready_queue[i] = ready_queue[i + 1];
-    }
-	ready_queue[THREAD_MAX_THREADS-1] = (Tid) -300;
-    if (index < 0 || index >= THREAD_MAX_THREADS) {
-        return;
-    }
+/* Returns whether vruntime a is less than vruntime b. */
+bool
+vruntime_before(unsigned long a, unsigned long b){
+	return (long)(a - b) < 0;
+}
 
+/* Returns the vruntime of t, charging the time it has been running up to
+ * now if it is running. */
+unsigned long
+fair_vruntime(struct thread *t, unsigned long now){
+	if (t->acct.state != ACCT_RUNNING){
+		return t->vruntime;
+	}
+	return t->vruntime + (now - t->acct.since) * THREAD_WEIGHT_DEFAULT / t->weight;
 }
 
-Tid find_tail_of_queue(){
-	for (int i=0; i<THREAD_MAX_THREADS-1; ++i){
-		if (ready_queue[i+1] == (Tid)-300){
-			Tid want_tid = ready_queue[i];
-			ready_queue[i] = (Tid) -300;
-			return want_tid;
-		}
+/* Returns whether ready thread a runs before ready thread b. */
+bool
+fair_before(struct thread *a, struct thread *b){
+	if (a->vruntime != b->vruntime){
+		return vruntime_before(a->vruntime, b->vruntime);
 	}
-	return -1;
+	return a->ready_seq < b->ready_seq;
 }
 
-Tid
-thread_yield(Tid want_tid)
-{
-	int e = interrupts_off();
-	/* ERROR CHECKING*/
-    if (want_tid == THREAD_SELF) {
-		interrupts_set(e);
-        return running_thread;
-    } else if (want_tid == THREAD_ANY){
-        if (ready_queue[0] == (Tid)-300) {
-			interrupts_set(e);
-			return THREAD_NONE;}
-    } else if (want_tid < 0){ 
-		interrupts_set(e);
-        return THREAD_INVALID;
-    } else {
-        if (running_thread ==  want_tid){ 
-			interrupts_set(e);
-			return thread_id();}
-        int index = find_index_in_queue(want_tid);
-        if (index == -1){
-			interrupts_set(e);
-			return THREAD_INVALID;}
-    }
+void
+fair_set(struct worker *w, int i, struct thread *t){
+	w->fair_heap[i] = t;
+	t->heap_index = i;
+}
 
+void
+fair_sift_up(struct worker *w, int i){
+	struct thread *t = w->fair_heap[i];
+	while (i > 0){
+		int parent = (i - 1) / 2;
+		if (!fair_before(t, w->fair_heap[parent])){
+			break;
+		}
+		fair_set(w, i, w->fair_heap[parent]);
+		i = parent;
+	}
+	fair_set(w, i, t);
+}
 
-    /* FIND THREAD YOU WANT TO YIELD TO*/
-    int new_thread_tid;
-    if (want_tid == THREAD_ANY){
-        new_thread_tid = ready_queue[0];
-        remove_from_queue(0);
-    } else {
-        new_thread_tid = want_tid;
-        int index = find_index_in_queue(want_tid);
-        remove_from_queue(index);
-    }
+void
+fair_sift_down(struct worker *w, int i){
+	struct thread *t = w->fair_heap[i];
+	int n = w->fair_queue.size;
+	for (;;){
+		int child = 2 * i + 1;
+		if (child >= n){
+			break;
+		}
+		if (child + 1 < n && fair_before(w->fair_heap[child + 1],
+						 w->fair_heap[child])){
+			++child;
+		}
+		if (!fair_before(w->fair_heap[child], t)){
+			break;
+		}
+		fair_set(w, i, w->fair_heap[child]);
+		i = child;
+	}
+	fair_set(w, i, t);
+}
 
-    /* YIELDING */
-    Tid run_thread = running_thread;
-	if (created_threads[(int) running_thread] -> sleeping != true) {add_to_queue_tail(run_thread);}
-    running_thread = new_thread_tid;
-    bool setcontext_called = false;
-	assert (!interrupts_enabled());
-    getcontext(&(created_threads[(int)run_thread]->context));
+void
+fair_push(struct worker *w, struct thread *t){
+	assert(t->queue == NULL);
+	t->queue = &w->fair_queue;
+	t->ready_seq = ready_pushes++;
+	fair_set(w, w->fair_queue.size++, t);
+	fair_sift_up(w, t->heap_index);
+}
 
-    if (setcontext_called){
-        thread_routine_cleanup();
-    } else {
-        setcontext_called = true;
-		assert (!interrupts_enabled());
-		assert (created_threads[(int)new_thread_tid]->sleeping == false);
-        setcontext(&(created_threads[(int)new_thread_tid]->context));
-    }
-	interrupts_set(e);
-    return new_thread_tid;
+void
+fair_remove(struct thread *t){
+	struct worker *w = t->queue->worker;
+	struct thread *last = w->fair_heap[--w->fair_queue.size];
+	int i = t->heap_index;
+
+	t->queue = NULL;
+	t->heap_index = -1;
+	if (last != t){
+		fair_set(w, i, last);
+		fair_sift_up(w, i);
+		fair_sift_down(w, last->heap_index);
+	}
 }
 
+/* Moves w->min_vruntime up to the least vruntime of the threads running or
+ * ready on w. */
 void
-freeup_leftover_zombies(){
-	int e = interrupts_off();
-	if (ready_queue[0]== (Tid)-300){
-		for (int i = 0; i<THREAD_MAX_THREADS; ++i){
-			if (created_threads[i] != NULL && i != running_thread){
-				thread_create_zombie(i);
-				thread_cleanup_zombie(created_threads[i]->stack_freed);
-				
-			}
+fair_update_min(struct worker *w){
+	struct thread *cur = w->running != (Tid)-300 ? get_thread(w->running) : NULL;
+	struct thread *first = w->fair_queue.size > 0 ? w->fair_heap[0] : NULL;
+	unsigned long min;
+
+	if (cur != NULL && cur->acct.state == ACCT_RUNNING){
+		min = fair_vruntime(cur, __rdtsc());
+		if (first != NULL && vruntime_before(first->vruntime, min)){
+			min = first->vruntime;
 		}
+	} else if (first != NULL){
+		min = first->vruntime;
+	} else {
+		return;
 	}
-	interrupts_set(e);
+	if (vruntime_before(w->min_vruntime, min)){
+		w->min_vruntime = min;
+	}
+}
+
+/* Returns the level a boost returns t to: its base level, or the priority
+ * it inherits if that is higher. */
+int
+prio_floor(struct thread *t){
+	return t->pi_prio < t->base_prio ? t->pi_prio : t->base_prio;
 }
 
+/* Brings t->prio up to date with the boosts since it was last looked at. A
+ * thread on a ready queue was moved to its ready_floor by the boost, and
+ * any other thread returns to its floor. */
 void
-thread_exit(int exit_code)
-{
-	interrupts_off();
-	cleanup_before_zombifying(running_thread);
-	if (ready_queue[0] == (Tid)-300){
-		freeup_leftover_zombies();
-		exit(0);}
-    else{
-		created_threads[(int)running_thread]->exit = exit_code;
-		--num_threads_created;
-        thread_create_zombie(running_thread);
-		running_thread = ready_queue[0];
-		remove_from_queue(0);
-		returning_from_exit = true;
-		assert (!interrupts_enabled());
-        setcontext(&(created_threads[(int)running_thread]->context));
-    }
+boost_sync(struct thread *t){
+	struct thread_queue *q = t->queue;
+
+	if (t->boost_seen == boost_epoch){
+		return;
+	}
+	t->boost_seen = boost_epoch;
+	if (q != NULL && q->worker != NULL && q != &q->worker->fair_queue){
+		t->prio = t->ready_floor;
+	} else if (prio_floor(t) < t->prio){
+		t->prio = prio_floor(t);
+	}
 }
 
-Tid
-thread_kill(Tid tid)
+/* Puts t at the tail of worker w's ready queue, at the level for its
+ * current priority, or on w's fair_heap under THREAD_SCHED_FAIR, and wakes
+ * up an idle worker to steal it. */
+void
+ready_push(struct worker *w, struct thread *t){
+	boost_sync(t);
+	if (sched_fair){
+		/* the running thread, on its way out, is charged up to now */
+		if (t->acct.state == ACCT_RUNNING){
+			acct_enter(t, ACCT_READY, __rdtsc());
+		}
+		fair_update_min(w);
+		if (vruntime_before(t->vruntime, w->min_vruntime - fair_credit)){
+			t->vruntime = w->min_vruntime - fair_credit;
+		}
+		fair_push(w, t);
+	} else {
+		int floor = prio_floor(t);
+		t->ready_floor = floor < t->prio ? floor : t->prio;
+		t->ready_seq = ready_pushes++;
+		queue_push_tail(&w->ready_queue[t->prio][t->ready_floor], t);
+		w->ready_floors[t->prio] |= 1u << t->ready_floor;
+		w->ready_levels |= 1u << t->prio;
+	}
+	++num_ready;
+	if (num_idle_workers > 0 && !t->pinned){
+		++idle_seq;
+		if (num_idle_workers > (int)io_poller_idle){
+			syscall(SYS_futex, &idle_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		} else {
+			/* the only idle worker is in epoll_wait */
+			eventfd_write(io_wakefd, 1);
+		}
+	}
+}
+
+void
+ready_remove(struct thread *t){
+	struct worker *w = t->queue->worker;
+	--num_ready;
+	if (t->queue == &w->fair_queue){
+		fair_remove(t);
+		return;
+	}
+	/* t->queue is the list t was put on, which a boost may have spliced */
+	boost_sync(t);
+	struct thread_queue *q = &w->ready_queue[t->prio][t->ready_floor];
+	queue_unlink(q, t);
+	t->queue = NULL;
+	if (q->head == NULL){
+		w->ready_floors[t->prio] &= ~(1u << t->ready_floor);
+		if (w->ready_floors[t->prio] == 0){
+			w->ready_levels &= ~(1u << t->prio);
+		}
+	}
+}
+
+/* Returns the thread at the head of level of w's ready queue, i.e., the
+ * first one made ready of the heads of its lists. */
+struct thread *
+ready_first(struct worker *w, int level){
+	struct thread *first = NULL;
+	for (unsigned int floors = w->ready_floors[level]; floors != 0;
+	     floors &= floors - 1){
+		struct thread *t = w->ready_queue[level][__builtin_ctz(floors)].head;
+		if (first == NULL || t->ready_seq < first->ready_seq){
+			first = t;
+		}
+	}
+	return first;
+}
+
+/* Returns the highest priority thread on w's ready queue that another
+ * worker may run, i.e., that is not pinned to w, or the one with the least
+ * vruntime under THREAD_SCHED_FAIR. */
+struct thread *
+steal_from(struct worker *w){
+	if (sched_fair){
+		struct thread *best = NULL;
+		for (int i = 0; i < w->fair_queue.size; i++){
+			struct thread *t = w->fair_heap[i];
+			if (!t->pinned && (best == NULL || fair_before(t, best))){
+				best = t;
+			}
+		}
+		return best;
+	}
+	for (unsigned int levels = w->ready_levels; levels != 0;
+	     levels &= levels - 1){
+		int level = __builtin_ctz(levels);
+		struct thread *best = NULL;
+		for (unsigned int floors = w->ready_floors[level]; floors != 0;
+		     floors &= floors - 1){
+			struct thread *t = w->ready_queue[level][__builtin_ctz(floors)].head;
+			while (t != NULL && t->pinned){
+				t = t->next;
+			}
+			if (t != NULL && (best == NULL || t->ready_seq < best->ready_seq)){
+				best = t;
+			}
+		}
+		if (best != NULL){
+			return best;
+		}
+	}
+	return NULL;
+}
+
+/* Removes and returns the first thread of the highest non-empty level of
+ * this worker's ready queue (the one with the least vruntime under
+ * THREAD_SCHED_FAIR), or a thread stolen from another worker if ours is
+ * empty. Returns NULL if no thread can run here. */
+struct thread *
+ready_pop(){
+	struct worker *w = current_worker();
+	struct thread *t = NULL;
+	if (sched_fair ? w->fair_queue.size != 0 : w->ready_levels != 0){
+		t = sched_fair ? w->fair_heap[0]
+			: ready_first(w, __builtin_ctz(w->ready_levels));
+	} else if (num_ready != 0){
+		for (int i = 1; i < num_workers && t == NULL; i++){
+			t = steal_from(&workers[(w->id + i) % num_workers]);
+		}
+	}
+	if (t != NULL){
+		struct worker *from = t->queue->worker;
+		ready_remove(t);
+		if (sched_fair && from != w){
+			t->vruntime += w->min_vruntime - from->min_vruntime;
+		}
+	}
+	return t;
+}
+
+void add_to_queue_tail(Tid id){
+	ready_push(current_worker(), get_thread(id));
+}
+
+/* Returns whether thread tid is runnable, i.e., sitting on a ready queue. */
+bool
+in_ready_queue(Tid tid){
+	struct thread *t = get_thread(tid);
+	if (t == NULL){
+		return false;
+	}
+	struct thread_queue *q = t->queue;
+	return q != NULL && q->worker != NULL;
+}
+
+/* Returns whether thread tid is running on a worker other than ours. */
+bool
+running_elsewhere(Tid tid){
+	struct worker *self = current_worker();
+	for (int i = 0; i < num_workers; i++){
+		if (&workers[i] != self && workers[i].running == tid){
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Returns whether a worker other than ours is running a thread, which may
+ * still wake up sleeping threads. */
+bool
+other_workers_busy(){
+	struct worker *self = current_worker();
+	for (int i = 0; i < num_workers; i++){
+		if (&workers[i] != self && workers[i].running != (Tid)-300){
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Moves t to priority level prio, requeueing it if it is ready. */
+void
+set_level(struct thread *t, int prio){
+	boost_sync(t);
+	if (t->prio == prio){
+		return;
+	}
+	if (in_ready_queue(t->Tid)){
+		struct worker *w = t->queue->worker;
+		ready_remove(t);
+		t->prio = prio;
+		ready_push(w, t);
+	} else {
+		t->prio = prio;
+	}
+}
+
+/* Returns the size class of a stack of size bytes, which stack_size_round
+ * has rounded, or -1 if it is larger than every class. */
+int
+stack_class_of(size_t size){
+	if (size > (size_t) THREAD_STACK_FLOOR << (STACK_CLASSES - 1)){
+		return -1;
+	}
+	return __builtin_ctzl(size / THREAD_STACK_FLOOR);
+}
+
+/* Rounds size up to its class, or to whole pages above the classes. */
+size_t
+stack_size_round(size_t size){
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t class_size = THREAD_STACK_FLOOR;
+
+	if (size > (size_t) THREAD_STACK_FLOOR << (STACK_CLASSES - 1)){
+		return (size + page - 1) & ~(page - 1);
+	}
+	while (class_size < size){
+		class_size <<= 1;
+	}
+	return class_size;
+}
+
+/* Puts a guard page at base. */
+bool
+stack_guard(char *base, size_t guard){
+	if (stack_guard_mprotect || madvise(base, guard, MADV_GUARD_INSTALL) != 0){
+		/* older kernels */
+		stack_guard_mprotect = true;
+		if (mprotect(base, guard, PROT_NONE) != 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Returns a stack of size bytes, which stack_size_round has rounded, or NULL
+ * if we are out of memory. */
+int *
+stack_pool_get(size_t size){
+	size_t guard = sysconf(_SC_PAGESIZE);
+	int c = stack_class_of(size);
+	struct stack_class *sc;
+	void *stack;
+
+	if (c < 0){
+		char *base = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK |
+				  MAP_NORESERVE, -1, 0);
+		if (base == MAP_FAILED){
+			return NULL;
+		}
+		if (!stack_guard(base, guard)){
+			munmap(base, guard + size);
+			return NULL;
+		}
+		return (int *) (base + guard);
+	}
+	sc = &stack_classes[c];
+	if (sc->pool != NULL){
+		stack = sc->pool;
+		sc->pool = *(void **) stack;
+		--sc->pool_size;
+		return stack;
+	}
+	if (sc->slab_left == 0){
+		int nstacks = STACK_SLAB_BYTES / size;
+		void *slab = mmap(NULL, (guard + size) * nstacks,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (slab == MAP_FAILED){
+			return NULL;
+		}
+		sc->slab = slab;
+		sc->slab_left = nstacks;
+	}
+	char *base = sc->slab;
+	if (!stack_guard(base, guard)){
+		return NULL;
+	}
+	sc->slab += guard + size;
+	--sc->slab_left;
+	return (int *) (base + guard);
+}
+
+void
+stack_pool_put(int *stack, size_t size){
+	size_t guard = sysconf(_SC_PAGESIZE);
+	int c = stack_class_of(size);
+	struct stack_class *sc;
+
+	if (stack == NULL){
+		return;
+	}
+	if (c < 0){
+		munmap((char *) stack - guard, guard + size);
+		return;
+	}
+	sc = &stack_classes[c];
+	if (sc->pool_size >= STACK_POOL_MAX){
+		/* keep the lowest page, which holds the freelist link */
+		madvise((char *) stack + guard, size - guard, MADV_DONTNEED);
+	}
+	*(void **) stack = sc->pool;
+	sc->pool = stack;
+	++sc->pool_size;
+}
+
+Tid
+thread_create(void (*fn) (void *), void *parg)
+{
+	return thread_create_prio(fn, parg, THREAD_PRIO_DEFAULT);
+}
+
+Tid
+thread_create_prio(void (*fn) (void *), void *parg, int prio)
+{
+	struct thread_attr attr;
+
+	thread_attr_init(&attr);
+	attr.prio = prio;
+	return thread_create_ex(fn, parg, &attr);
+}
+
+/* Copies name, truncated, into t, or clears t's name if it is NULL. */
+void
+thread_set_name(struct thread *t, const char *name){
+	if (name == NULL){
+		t->name[0] = '\0';
+		return;
+	}
+	strncpy(t->name, name, THREAD_NAME_LEN - 1);
+	t->name[THREAD_NAME_LEN - 1] = '\0';
+}
+
+void
+thread_attr_init(struct thread_attr *attr)
+{
+	attr->stack_size = THREAD_MIN_STACK;
+	attr->prio = THREAD_PRIO_DEFAULT;
+	attr->weight = THREAD_WEIGHT_DEFAULT;
+	attr->name = NULL;
+}
+
+Tid
+thread_create_ex(void (*fn) (void *), void *parg,
+		 const struct thread_attr *attr)
 {
+	struct thread_attr defaults;
+
+	if (attr == NULL){
+		thread_attr_init(&defaults);
+		attr = &defaults;
+	}
+	int prio = attr->prio;
+	size_t stack_size = attr->stack_size == 0 ? THREAD_MIN_STACK : attr->stack_size;
+	if (prio < THREAD_PRIO_HIGHEST || prio > THREAD_PRIO_LOWEST){
+		return THREAD_INVALID;}
+	if (stack_size < THREAD_STACK_FLOOR || stack_size > THREAD_MAX_STACK){
+		return THREAD_INVALID;}
+	if (attr->weight < 1 || attr->weight > THREAD_WEIGHT_MAX){
+		return THREAD_INVALID;}
+	stack_size = stack_size_round(stack_size);
 	int e = interrupts_off();
-	int i = find_index_in_queue(tid);
-	// check if thread exists, if not return THREAD_INVALID
-	if (tid == running_thread) {
+	// if no more space for another thread -> THREAD_NO_MORE
+	// i.e., every id up to the max_threads ceiling is in use
+	if(!tid_available()){
 		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (tid < 0 || tid >= THREAD_MAX_THREADS){
+		return THREAD_NOMORE;}
+	// 3. need a stack, taken from the stack pool if one is cached
+	int *lower_limit = stack_pool_get(stack_size);
+	if (lower_limit == NULL) {
 		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (i == -1 && created_threads[tid]!=NULL && created_threads[tid]->sleeping == false){
+		return THREAD_NOMEMORY;}
+	// what is the tid of our thread?
+	Tid create_thread_tid = remove_from_available();
+	if (create_thread_tid == (Tid) -300) {
+		stack_pool_put(lower_limit, stack_size);
 		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (created_threads[(int) tid] == NULL){
+		return THREAD_NOMEMORY;}
+	++num_threads_created;
+
+	// turns out we do have space to create a thread
+	struct thread* create_thread = malloc369(sizeof(struct thread));
+
+	create_thread->Tid = create_thread_tid;
+	create_thread->stack_addr = lower_limit;
+	create_thread->stack_size = stack_size;
+	thread_set_name(create_thread, attr->name);
+	create_thread->killed = false;
+	create_thread -> sleeping = false;
+	create_thread->wq = NULL;
+	create_thread -> waiting_on = -300;
+	create_thread -> exit = -300;
+	create_thread ->parent = running_thread;
+	create_thread->stack_freed = false;
+	create_thread->next = NULL;
+	create_thread->prev = NULL;
+	create_thread->queue = NULL;
+	create_thread->handoff_obj = NULL;
+	create_thread->handoff_abandon = NULL;
+	create_thread->timer.slot = NULL;
+	create_thread->timed_out = false;
+	create_thread->io_waiting = false;
+	create_thread->chan_msg = NULL;
+	create_thread->chan_done = false;
+	acct_init(create_thread, ACCT_READY);
+	create_thread->base_prio = prio;
+	create_thread->prio = prio;
+	create_thread->pi_prio = THREAD_PRIO_LEVELS;
+	create_thread->locks_held = NULL;
+	create_thread->waiting_lock = NULL;
+	/* a new thread starts level with the threads on our worker */
+	if (sched_fair){
+		fair_update_min(current_worker());
+	}
+	create_thread->vruntime = current_worker()->min_vruntime;
+	create_thread->weight = attr->weight;
+	create_thread->heap_index = -1;
+	create_thread->pinned = false;
+	// 4. the first switch to the new thread calls thread_stub(fn, parg) at the top of the new stack
+	unsigned long upper_limit = ((unsigned long)lower_limit) + (unsigned long) (stack_size);
+	context_init(&(create_thread->context), (void *) upper_limit,
+		     (void (*)(void *, void *)) thread_stub, fn, parg);
+
+	// add this thread to the thread table
+	set_thread(create_thread_tid, create_thread);
+	// add this thread to ready_queue
+	add_to_queue_tail(create_thread_tid);
+	trace_record(TRACE_CREATE, running_thread, create_thread_tid, 0);
+	// return tid of created thread
+	interrupts_set(e);
+	return create_thread_tid;
+
+}
+
+void 
+thread_create_zombie(Tid thread){
+    zombie_tid = thread;
+    zombie_stack_addr = get_thread(thread)->stack_addr;
+}
+
+void 
+cleanup_before_zombifying(Tid zombie){
+	/* CLEANUP WAITS BEFORE EXITING*/
+	struct thread* zombie_thread = get_thread(zombie);
+	/* a thread killed after a lock was handed to it, but before it ran,
+	 * passes the lock on */
+	if (zombie_thread->handoff_obj != NULL){
+		zombie_thread->handoff_abandon(zombie_thread->handoff_obj, zombie);
+		zombie_thread->handoff_obj = NULL;
+	}
+	/* a thread killed while it waits for a lock never gets back to
+	 * lock_acquire, so the holder stops inheriting from it here */
+	if (zombie_thread->waiting_lock != NULL){
+		struct lock *lock = zombie_thread->waiting_lock;
+		zombie_thread->waiting_lock = NULL;
+		pi_leave(lock);
+	}
+	/* a thread killed while it waits for an fd never gets back to
+	 * io_wait */
+	if (zombie_thread->io_waiting){
+		zombie_thread->io_waiting = false;
+		--num_io_waiters;
+	}
+	if (zombie_thread ->wq != NULL && zombie_thread->wq->threads.head != NULL){
+		thread_wakeup(zombie_thread->wq, false);
+	}
+}
+
+void 
+thread_cleanup_zombie(bool freed_stack){
+    assert(zombie_tid != (Tid)-300);
+	wait_queue_destroy(get_thread(zombie_tid)->wq);
+	get_thread(zombie_tid)->wq = NULL;
+	assert(get_thread(zombie_tid)->wq == NULL);
+
+	if (!freed_stack){
+		stack_pool_put(get_thread(zombie_tid)->stack_addr,
+			       get_thread(zombie_tid)->stack_size);
+		get_thread(zombie_tid)->stack_addr = NULL;
+	}
+	assert (get_thread(zombie_tid)->stack_addr == NULL);
+
+    free369(get_thread(zombie_tid));
+    set_thread(zombie_tid, NULL);
+	append_to_available(zombie_tid);
+    zombie_tid = (Tid)-300;
+    zombie_stack_addr = NULL;
+}
+
+
+/* Returns the stack of the last thread to exit to the pool, once we have
+ * switched off it. */
+void
+thread_free_zombie_stack(){
+	if (zombie_tid != -300){ 
+		//cleanup stack pointer
+		stack_pool_put(get_thread(zombie_tid)->stack_addr,
+			       get_thread(zombie_tid)->stack_size);
+		get_thread(zombie_tid)->stack_addr = NULL;
+		get_thread(zombie_tid)->stack_freed = true;
+		zombie_tid = (Tid)-300;
+		zombie_stack_addr = NULL;
+	}
+}
+
+void
+thread_routine_cleanup(){
+	// check if running thread is exited
+	thread_free_zombie_stack();
+	interrupts_off();
+    if (get_thread(running_thread)->killed){
+        thread_exit(-SIGKILL);
+    }
+}
+
+Tid
+thread_yield(Tid want_tid)
+{
+	int e = interrupts_off();
+	/* ERROR CHECKING*/
+    if (want_tid == THREAD_SELF) {
 		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (tid == zombie_tid || created_threads[(int) tid]->killed){
+        return running_thread;
+    } else if (want_tid < 0 && want_tid != THREAD_ANY){ 
 		interrupts_set(e);
-		return THREAD_INVALID;
+        return THREAD_INVALID;
+    } else if (want_tid != THREAD_ANY) {
+        if (running_thread ==  want_tid){ 
+			interrupts_set(e);
+			return thread_id();}
+        if (!in_ready_queue(want_tid)){
+			interrupts_set(e);
+			return THREAD_INVALID;}
+        /* a preempted thread can only resume on its own worker */
+        if (get_thread(want_tid)->pinned &&
+            get_thread(want_tid)->queue->worker != current_worker()){
+			interrupts_set(e);
+			return THREAD_INVALID;}
+    }
+
+
+    /* FIND THREAD YOU WANT TO YIELD TO*/
+    struct thread *cur = get_thread(running_thread);
+    struct thread *next;
+    if (want_tid == THREAD_ANY){
+        timer_advance();
+        next = ready_pop();
+        if (next == NULL && !cur->sleeping) {
+			interrupts_set(e);
+			return THREAD_NONE;}
+    } else {
+        next = get_thread(want_tid);
+        ready_remove(next);
+    }
+
+    /* YIELDING */
+    /* a thread going to sleep with nothing else to run leaves its worker
+     * idle, until another worker or a timer wakes a thread up */
+    Tid new_thread_tid = (next != NULL) ? next->Tid : cur->Tid;
+	if (cur->sleeping){
+		++cur->acct.sleeps;
+	} else if (cur->pinned){
+		++cur->acct.preemptions;
 	} else {
-		struct thread* t = created_threads[(int)tid];
-		t->killed = true;
-		if (t->wq != NULL && t->wq->head != NULL){
-			thread_wakeup(t->wq, false);
-		} 
+		++cur->acct.yields;
+	}
+	if (cur->sleeping != true) {ready_push(current_worker(), cur);}
+	switch_to(cur, next);
+	thread_routine_cleanup();
+	interrupts_set(e);
+    return new_thread_tid;
+}
+
+/* Switches from the running thread cur to next, or to this worker's idle
+ * loop if next is NULL. Returns when cur is switched back to, possibly on
+ * another worker. */
+void
+switch_to(struct thread *cur, struct thread *next){
+	struct worker *w = current_worker();
+
+	assert (!interrupts_enabled());
+	unsigned long now = __rdtsc();
+	acct_enter(cur, cur->exit != -300 ? ACCT_EXITED :
+		   cur->sleeping ? ACCT_BLOCKED : ACCT_READY, now);
+	trace_record(cur->exit != -300 ? TRACE_EXIT : cur->sleeping ? TRACE_SLEEP :
+		     cur->pinned ? TRACE_PREEMPT : TRACE_YIELD, cur->Tid,
+		     next != NULL ? next->Tid : THREAD_NONE, cur->exit);
+	/* interrupts are disabled on both sides of the switch, so the signal
+	 * mask does not need to be saved or restored. errno is per worker, so
+	 * it is saved, or another thread could clobber it between a failed
+	 * call and the check of errno */
+	cur->saved_errno = errno;
+	if (next == NULL){
+		w->running = (Tid)-300;
+		context_switch(&cur->context, &w->idle_context);
+	} else {
+		assert (next->sleeping == false);
+		acct_enter(next, ACCT_RUNNING, now);
+		w->running = next->Tid;
+		context_switch(&cur->context, &next->context);
+	}
+	errno = cur->saved_errno;
+}
+
+/* The idle loop of a worker, entered with interrupts disabled. It runs ready
+ * threads, and when there are none it releases the scheduler lock and waits
+ * until a thread is made ready, the next timer may expire, or an fd that a
+ * thread waits for is ready. Threads that block or exit on this worker
+ * with nothing else to run switch back here. */
+void
+worker_idle(void *arg0, void *arg1){
+	struct worker *w = arg0;
+	for (;;){
+		thread_free_zombie_stack();
+		timer_advance();
+		struct thread *t = ready_pop();
+		if (t != NULL){
+			acct_enter(t, ACCT_RUNNING, __rdtsc());
+			trace_record(TRACE_RUN, t->Tid, THREAD_NONE, 0);
+			w->running = t->Tid;
+			context_switch(&w->idle_context, &t->context);
+			continue;
+		}
+		/* wait for a thread to be made ready, or for the next timer */
+		struct timespec timeout, *tp = NULL;
+		if (num_timers > 0){
+			long ns = timer_next_ns();
+			timeout.tv_sec = ns / 1000000000L;
+			timeout.tv_nsec = ns % 1000000000L;
+			tp = &timeout;
+		}
+		/* one idle worker waits for threads' fds as well */
+		if (num_io_waiters > 0 && !io_poller_idle){
+			io_poll(tp, true);
+			continue;
+		}
+		int seq = idle_seq;
+		++num_idle_workers;
+		if (num_workers > 1){
+			interrupts_unlock();
+		}
+		syscall(SYS_futex, &idle_seq, FUTEX_WAIT_PRIVATE, seq, tp, NULL, 0);
+		if (num_workers > 1){
+			interrupts_lock();
+		}
+		--num_idle_workers;
+	}
+}
+
+/* Worker 0 runs the initial thread on the process stack, so its idle loop
+ * needs a stack of its own. */
+void
+worker_init_idle(struct worker *w){
+	w->idle_stack = stack_pool_get(THREAD_MIN_STACK);
+	assert(w->idle_stack != NULL);
+	context_init(&w->idle_context, (char *) w->idle_stack + THREAD_MIN_STACK,
+		     worker_idle, w, NULL);
+}
+
+void *
+worker_main(void *arg){
+	struct worker *w = arg;
+	self_worker = w;
+	w->ktid = gettid();
+	interrupts_off();
+	worker_idle(w, NULL);
+	return NULL;
+}
+
+/* Starts workers 1 to nworkers-1. The initial kernel thread is worker 0. */
+void
+start_workers(int nworkers){
+	struct worker *w0 = &workers[0];
+
+	interrupts_enable_smp();
+	w0->ktid = gettid();
+	interrupts_add_worker(w0->ktid);
+
+	int e = interrupts_off();
+	num_workers = nworkers;
+	for (int i = 1; i < nworkers; i++){
+		int ret = pthread_create(&workers[i].pthread, NULL, worker_main, &workers[i]);
+		assert(ret == 0);
+	}
+	interrupts_set(e);
+	for (int i = 1; i < nworkers; i++){
+		while (workers[i].ktid == 0){
+			sched_yield();
+		}
+		interrupts_add_worker(workers[i].ktid);
+	}
+}
+
+void
+freeup_leftover_zombies(){
+	int e = interrupts_off();
+	if (num_ready == 0){
+		for (int i = 0; i < next_tid; ++i){
+			if (get_thread(i) != NULL && i != running_thread){
+				thread_create_zombie(i);
+				thread_cleanup_zombie(get_thread(i)->stack_freed);
+				
+			}
+		}
 	}
 	interrupts_set(e);
-	return tid;
 }
 
-/**************************************************************************
- * Important: The rest of the code should be implemented in Assignment 2. *
- **************************************************************************/
+void
+thread_exit(int exit_code)
+{
+	interrupts_off();
+	cleanup_before_zombifying(running_thread);
+	if (num_ready == 0 && !other_workers_busy() && num_timers == 0 &&
+	    num_io_waiters == 0){
+		freeup_leftover_zombies();
+		exit(0);}
+    else{
+		get_thread(running_thread)->exit = exit_code;
+		--num_threads_created;
+        thread_create_zombie(running_thread);
+		Tid exiting = running_thread;
+		returning_from_exit = true;
+		/* the zombie's TCB lives until it is reaped, so it can hold the
+		 * context we never come back to */
+		switch_to(get_thread(exiting), ready_pop());
+		assert(0);
+    }
+}
+
+Tid
+thread_kill(Tid tid)
+{
+	int e = interrupts_off();
+	// check if thread exists, if not return THREAD_INVALID
+	if (tid == running_thread) {
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (get_thread(tid) == NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (!in_ready_queue(tid) && get_thread(tid)!=NULL && get_thread(tid)->sleeping == false
+		   && !running_elsewhere(tid)){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (get_thread(tid) == NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (tid == zombie_tid || get_thread(tid)->killed){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else {
+		struct thread* t = get_thread(tid);
+		/* threads waiting on t are woken when t exits, which it does
+		 * the next time it is scheduled. If t is asleep, take it off
+		 * its wait queue so that it gets scheduled. */
+		t->killed = true;
+		if (t->sleeping && !in_ready_queue(tid)
+		    && (t->queue != NULL || t->timer.slot != NULL)){
+			/* nothing was handed to it */
+			t->handoff_obj = NULL;
+			wakeup_thread(t);
+		}
+	}
+	interrupts_set(e);
+	return tid;
+}
+
+long
+thread_set_quantum(unsigned long usecs)
+{
+	if (usecs == 0){
+		return THREAD_INVALID;
+	}
+	return interrupts_set_interval(usecs);
+}
+
+Tid
+thread_set_priority(Tid tid, int prio)
+{
+	int e = interrupts_off();
+	if (get_thread(tid) == NULL
+	    || prio < THREAD_PRIO_HIGHEST || prio > THREAD_PRIO_LOWEST){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	}
+	struct thread *t = get_thread(tid);
+	t->base_prio = prio;
+	set_level(t, prio_floor(t));
+	interrupts_set(e);
+	return tid;
+}
+
+/* Converts FAIR_SLEEPER_USECS to time stamp counter cycles, which is
+ * measured more precisely the longer the library runs. */
+void
+fair_credit_update(){
+	fair_credit = FAIR_SLEEPER_USECS * 1000 / acct_ns_per_cycle();
+}
+
+/* Maps a fair_heap for every worker that has none. Each has room for every
+ * thread, but only the pages that are used become resident. */
+bool
+fair_heap_alloc(){
+	for (int i = 0; i < num_workers; i++){
+		if (workers[i].fair_heap == NULL){
+			void *heap = mmap(NULL, THREAD_MAX_THREADS_LIMIT * sizeof(struct thread *),
+					  PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+					  -1, 0);
+			if (heap == MAP_FAILED){
+				return false;
+			}
+			workers[i].fair_heap = heap;
+		}
+	}
+	return true;
+}
+
+int
+thread_set_sched(int policy)
+{
+	if (policy != THREAD_SCHED_MLFQ && policy != THREAD_SCHED_FAIR){
+		return THREAD_INVALID;
+	}
+	int e = interrupts_off();
+	int ret = sched_fair ? THREAD_SCHED_FAIR : THREAD_SCHED_MLFQ;
+	if (policy == ret){
+		interrupts_set(e);
+		return ret;
+	}
+	if (policy == THREAD_SCHED_FAIR){
+		if (!fair_heap_alloc()){
+			interrupts_set(e);
+			return THREAD_NOMEMORY;
+		}
+		/* every thread starts even */
+		for (int i = 0; i < next_tid; i++){
+			if (get_thread(i) != NULL){
+				get_thread(i)->vruntime = 0;
+			}
+		}
+		for (int i = 0; i < num_workers; i++){
+			workers[i].min_vruntime = 0;
+		}
+		fair_credit_update();
+	}
+	/* ready_remove takes a thread off the queue it is on, and ready_push
+	 * puts it on the one of the new policy, on the same worker */
+	sched_fair = policy == THREAD_SCHED_FAIR;
+	for (int i = 0; i < num_workers; i++){
+		struct worker *w = &workers[i];
+		for (;;){
+			struct thread *t;
+			if (sched_fair && w->ready_levels != 0){
+				t = ready_first(w, __builtin_ctz(w->ready_levels));
+			} else if (!sched_fair && w->fair_queue.size != 0){
+				t = w->fair_heap[0];
+			} else {
+				break;
+			}
+			ready_remove(t);
+			ready_push(w, t);
+		}
+	}
+	interrupts_set(e);
+	return ret;
+}
+
+Tid
+thread_set_weight(Tid tid, int weight)
+{
+	int e = interrupts_off();
+	struct thread *t = get_thread(tid);
+	if (t == NULL || weight < 1 || weight > THREAD_WEIGHT_MAX){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	}
+	/* the time it has been running is charged at its old weight */
+	if (t->acct.state == ACCT_RUNNING){
+		acct_enter(t, ACCT_RUNNING, __rdtsc());
+	}
+	t->weight = weight;
+	interrupts_set(e);
+	return tid;
+}
+
+/* Scheduling statistics. Every state change of a thread reads the time
+ * stamp counter once and charges the time since the last change to the
+ * state it leaves, so keeping the statistics costs two rdtsc per context
+ * switch. */
+void
+acct_init(struct thread *t, enum acct_state state){
+	memset(&t->acct, 0, sizeof(t->acct));
+	t->acct.state = state;
+	t->acct.since = __rdtsc();
+}
+
+void
+acct_enter(struct thread *t, enum acct_state state, unsigned long now){
+	if (sched_fair){
+		t->vruntime = fair_vruntime(t, now);
+	}
+	if (t->acct.state != ACCT_EXITED){
+		t->acct.cycles[t->acct.state] += now - t->acct.since;
+	}
+	t->acct.state = state;
+	t->acct.since = now;
+}
+
+/* Returns the length of a time stamp counter cycle in ns, as measured since
+ * thread_init. */
+double
+acct_ns_per_cycle(){
+	unsigned long cycles = __rdtsc() - acct_tsc0;
+	long ns = clock_ns() - acct_ns0;
+	return cycles > 0 && ns > 0 ? (double) ns / cycles : 1.0;
+}
+
+/* Fills in stats for t, charging its current state up to now. */
+void
+acct_read(struct thread *t, struct thread_stats *stats, double ns_per_cycle){
+	unsigned long cycles[ACCT_EXITED];
+
+	memcpy(cycles, t->acct.cycles, sizeof(cycles));
+	if (t->acct.state != ACCT_EXITED){
+		cycles[t->acct.state] += __rdtsc() - t->acct.since;
+	}
+	stats->cpu_ns = cycles[ACCT_RUNNING] * ns_per_cycle;
+	stats->ready_ns = cycles[ACCT_READY] * ns_per_cycle;
+	stats->blocked_ns = cycles[ACCT_BLOCKED] * ns_per_cycle;
+	stats->yields = t->acct.yields;
+	stats->preemptions = t->acct.preemptions;
+	stats->sleeps = t->acct.sleeps;
+	memcpy(stats->name, t->name, THREAD_NAME_LEN);
+}
+
+Tid
+thread_stats(Tid tid, struct thread_stats *stats)
+{
+	int e = interrupts_off();
+	struct thread *t = get_thread(tid);
+	if (t == NULL || stats == NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	}
+	acct_read(t, stats, acct_ns_per_cycle());
+	interrupts_set(e);
+	return tid;
+}
+
+void
+thread_stats_dump(void)
+{
+	static const char *states[] = {"running", "ready", "blocked", "exited"};
+	struct thread_stats stats, total;
+	int e = interrupts_off();
+	double ns_per_cycle = acct_ns_per_cycle();
+
+	memset(&total, 0, sizeof(total));
+	printf("%6s %-15s %-8s %12s %12s %12s %10s %10s %10s\n", "tid",
+	       "name", "state", "cpu_us", "ready_us", "blocked_us", "yields",
+	       "preempts", "sleeps");
+	for (Tid i = 0; i < next_tid; i++){
+		struct thread *t = get_thread(i);
+		if (t == NULL){
+			continue;
+		}
+		acct_read(t, &stats, ns_per_cycle);
+		printf("%6d %-15s %-8s %12lu %12lu %12lu %10lu %10lu %10lu\n",
+		       i, stats.name, states[t->acct.state], stats.cpu_ns / 1000,
+		       stats.ready_ns / 1000, stats.blocked_ns / 1000,
+		       stats.yields, stats.preemptions, stats.sleeps);
+		total.cpu_ns += stats.cpu_ns;
+		total.ready_ns += stats.ready_ns;
+		total.blocked_ns += stats.blocked_ns;
+		total.yields += stats.yields;
+		total.preemptions += stats.preemptions;
+		total.sleeps += stats.sleeps;
+	}
+	printf("%6s %-15s %-8s %12lu %12lu %12lu %10lu %10lu %10lu\n",
+	       "total", "", "", total.cpu_ns / 1000, total.ready_ns / 1000,
+	       total.blocked_ns / 1000, total.yields, total.preemptions,
+	       total.sleeps);
+	fflush(stdout);
+	interrupts_set(e);
+}
+
+void
+trace_record(enum trace_type type, Tid tid, Tid other, long arg){
+	if (!trace_on){
+		return;
+	}
+	unsigned long i = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct trace_event *ev = &trace_ring[i & TRACE_MASK];
+
+	/* readers skip the slot while we fill it in */
+	__atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ev->tsc = __rdtsc();
+	ev->type = type;
+	ev->worker = current_worker()->id;
+	ev->tid = tid;
+	ev->other = other;
+	ev->arg = arg;
+	__atomic_store_n(&ev->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+int
+thread_trace_enable(int on)
+{
+	int was_on = trace_on;
+	__atomic_store_n(&trace_on, on != 0, __ATOMIC_RELAXED);
+	return was_on;
+}
+
+/* Copies event i of the trace into ev. Returns false if it was overwritten,
+ * or is still being written. */
+bool
+trace_read(unsigned long i, struct trace_event *ev){
+	struct trace_event *slot = &trace_ring[i & TRACE_MASK];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1){
+		return false;
+	}
+	*ev = *slot;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == i + 1;
+}
+
+/* Writes one event in the Chrome trace event format. Every thread is a track
+ * of process 0, a thread running is a "run" slice from the switch to it to
+ * the switch away from it, and the other events are instants. */
+void
+trace_write_event(FILE *f, struct trace_event *ev, double us_per_cycle,
+		  bool first){
+	static const char *switches[] = {
+		[TRACE_YIELD] = "yield",
+		[TRACE_PREEMPT] = "preempt",
+		[TRACE_SLEEP] = "sleep",
+		[TRACE_EXIT] = "exit",
+	};
+	double ts = (double) (ev->tsc - acct_tsc0) * us_per_cycle;
+	const char *sep = first ? "" : ",\n";
+
+	switch (ev->type){
+	case TRACE_CREATE:
+		fprintf(f, "%s{\"name\":\"create\",\"ph\":\"i\",\"s\":\"t\","
+			"\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+			"\"args\":{\"child\":%d}}", sep, ev->tid, ts,
+			ev->other);
+		break;
+	case TRACE_YIELD:
+	case TRACE_PREEMPT:
+	case TRACE_SLEEP:
+	case TRACE_EXIT:
+		fprintf(f, "%s{\"name\":\"run\",\"ph\":\"E\",\"pid\":0,"
+			"\"tid\":%d,\"ts\":%.3f,\"args\":{\"switch\":\"%s\"",
+			sep, ev->tid, ts, switches[ev->type]);
+		if (ev->type == TRACE_EXIT){
+			fprintf(f, ",\"exit\":%ld", ev->arg);
+		}
+		fprintf(f, "}}");
+		if (ev->other >= 0){
+			fprintf(f, ",\n{\"name\":\"run\",\"ph\":\"B\",\"pid\":0,"
+				"\"tid\":%d,\"ts\":%.3f,"
+				"\"args\":{\"worker\":%d}}", ev->other, ts,
+				ev->worker);
+		}
+		break;
+	case TRACE_RUN:
+		fprintf(f, "%s{\"name\":\"run\",\"ph\":\"B\",\"pid\":0,"
+			"\"tid\":%d,\"ts\":%.3f,\"args\":{\"worker\":%d}}",
+			sep, ev->tid, ts, ev->worker);
+		break;
+	case TRACE_WAKEUP:
+		fprintf(f, "%s{\"name\":\"wakeup\",\"ph\":\"i\",\"s\":\"t\","
+			"\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+			"\"args\":{\"by\":%d}}", sep, ev->tid, ts, ev->other);
+		break;
+	case TRACE_TICK:
+		fprintf(f, "%s{\"name\":\"tick\",\"ph\":\"i\",\"s\":\"t\","
+			"\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+			"\"args\":{\"worker\":%d}}", sep, ev->tid, ts,
+			ev->worker);
+		break;
+	case TRACE_LOCK_CONTEND:
+		fprintf(f, "%s{\"name\":\"lock_contend\",\"ph\":\"i\","
+			"\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+			"\"args\":{\"lock\":\"%#lx\",\"holder\":%d}}", sep,
+			ev->tid, ts, (unsigned long) ev->arg, ev->other);
+		break;
+	}
+}
+
+/* Writes a metadata event that names the track of thread tid. */
+void
+trace_write_name(FILE *f, Tid tid, const char *name, bool first){
+	fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+		"\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",\n", tid);
+	for (; *name != '\0'; name++){
+		if (*name == '"' || *name == '\\'){
+			fputc('\\', f);
+		}
+		fputc((unsigned char) *name < ' ' ? '?' : *name, f);
+	}
+	fprintf(f, "\"}}");
+}
+
+int
+thread_trace_dump(const char *path)
+{
+	struct trace_event ev;
+	int n = 0;
+	int e = interrupts_off();
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL){
+		interrupts_set(e);
+		return -1;
+	}
+	double us_per_cycle = acct_ns_per_cycle() / 1000;
+	unsigned long head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	unsigned long i = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (; i < head; i++){
+		if (trace_read(i, &ev)){
+			trace_write_event(f, &ev, us_per_cycle, n == 0);
+			++n;
+		}
+	}
+	/* label the tracks of named threads, which are not counted as events */
+	bool first = n == 0;
+	for (Tid tid = 0; tid < next_tid; tid++){
+		struct thread *t = get_thread(tid);
+		if (t != NULL && t->name[0] != '\0'){
+			trace_write_name(f, tid, t->name, first);
+			first = false;
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	if (fclose(f) != 0){
+		n = -1;
+	}
+	interrupts_set(e);
+	return n;
+}
+
+long
+clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+unsigned long
+current_tick(void)
+{
+	return clock_ns() / (WHEEL_TICK_USECS * 1000L);
+}
+
+/* Puts t's timer on the wheel, in the lowest level that reaches its expiry.
+ * Timers beyond the last level wait in its furthest slot, and are placed
+ * again when that slot moves down. */
+void
+timer_place(struct thread *t){
+	unsigned long expires = t->timer.expires;
+	unsigned long max = 1UL << (WHEEL_BITS * WHEEL_LEVELS);
+	int level = 0;
+
+	if (expires < wheel_tick){
+		expires = wheel_tick;
+	} else if (expires - wheel_tick >= max){
+		expires = wheel_tick + max - 1;
+	}
+	while (expires - wheel_tick >= 1UL << (WHEEL_BITS * (level + 1))){
+		++level;
+	}
+	struct thread **slot = &wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	t->timer.prev = NULL;
+	t->timer.next = *slot;
+	if (*slot != NULL){
+		(*slot)->timer.prev = t;
+	}
+	*slot = t;
+	t->timer.slot = slot;
+}
+
+void
+timer_unlink(struct thread *t){
+	if (t->timer.prev == NULL){
+		*t->timer.slot = t->timer.next;
+	} else {
+		t->timer.prev->timer.next = t->timer.next;
+	}
+	if (t->timer.next != NULL){
+		t->timer.next->timer.prev = t->timer.prev;
+	}
+	t->timer.slot = NULL;
+}
+
+/* Wakes t up after usecs microseconds, unless it is woken up before. */
+void
+timer_arm(struct thread *t, unsigned long usecs){
+	long tick_ns = WHEEL_TICK_USECS * 1000L;
+
+	assert(t->timer.slot == NULL);
+	if (num_timers == 0){
+		/* nothing happened while the wheel was empty */
+		wheel_tick = current_tick();
+	}
+	/* the first tick that starts at least usecs from now */
+	t->timer.expires = (clock_ns() + usecs * 1000 + tick_ns - 1) / tick_ns;
+	t->timed_out = false;
+	++num_timers;
+	timer_place(t);
+}
+
+void
+timer_cancel(struct thread *t){
+	timer_unlink(t);
+	--num_timers;
+}
+
+/* Expires the timers of wheel_tick, first moving a slot of each higher
+ * level down if the level below wrapped around. */
+void
+timer_tick(){
+	unsigned long tick = wheel_tick;
+	struct thread *t, *next;
+
+	if ((tick & WHEEL_MASK) == 0){
+		for (int level = 1; level < WHEEL_LEVELS; level++){
+			int index = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			t = wheel[level][index];
+			wheel[level][index] = NULL;
+			for (; t != NULL; t = next){
+				next = t->timer.next;
+				timer_place(t);
+			}
+			if (index != 0){
+				break;
+			}
+		}
+	}
+	t = wheel[0][tick & WHEEL_MASK];
+	wheel[0][tick & WHEEL_MASK] = NULL;
+	for (; t != NULL; t = next){
+		next = t->timer.next;
+		t->timer.slot = NULL;
+		--num_timers;
+		t->timed_out = true;
+		if (t->sleeping){
+			wakeup_thread(t);
+		}
+	}
+	++wheel_tick;
+}
+
+/* Expires every timer that is due. */
+void
+timer_advance(){
+	if (num_timers == 0){
+		return;
+	}
+	unsigned long now = current_tick();
+	while (wheel_tick <= now && num_timers > 0){
+		timer_tick();
+	}
+}
+
+/* Returns how long, in ns, an idle worker can wait before a timer may be
+ * due: until the next non-empty slot of level 0, or until level 0 wraps
+ * around and timers move down from level 1. */
+long
+timer_next_ns(){
+	unsigned long tick = wheel_tick;
+	do {
+		if (wheel[0][tick & WHEEL_MASK] != NULL){
+			break;
+		}
+		++tick;
+	} while ((tick & WHEEL_MASK) != 0);
+	long ns = tick * WHEEL_TICK_USECS * 1000L - clock_ns();
+	return ns > 0 ? ns : 0;
+}
+
+void
+thread_sleep_for(unsigned long usecs)
+{
+	int e = interrupts_off();
+	struct thread *t = get_thread(running_thread);
+
+	/* like thread_sleep, blocking counts as interactive */
+	boost_sync(t);
+	if (t->prio > t->base_prio){
+		--t->prio;
+	}
+	timer_arm(t, usecs);
+	t->sleeping = true;
+	thread_yield(THREAD_ANY);
+	interrupts_set(e);
+}
+
+/* Returns every thread to its floor (see prio_floor), in time that does
+ * not depend on the number of threads: each ready_queue[level][floor] is
+ * spliced onto ready_queue[floor][floor], and the other threads catch up in
+ * boost_sync. A thread whose floor rose while it was ready is returned to
+ * the one it had when it was made ready. */
+void
+priority_boost(){
+	++boost_epoch;
+	for (int i = 0; i < num_workers; i++){
+		struct worker *w = &workers[i];
+		for (int level = 1; level < THREAD_PRIO_LEVELS; level++){
+			unsigned int floors = w->ready_floors[level] & ((1u << level) - 1);
+			for (; floors != 0; floors &= floors - 1){
+				int floor = __builtin_ctz(floors);
+				queue_splice(&w->ready_queue[floor][floor],
+					     &w->ready_queue[level][floor]);
+				w->ready_floors[floor] |= 1u << floor;
+				w->ready_levels |= 1u << floor;
+			}
+			w->ready_floors[level] &= 1u << level;
+			if (w->ready_floors[level] == 0){
+				w->ready_levels &= ~(1u << level);
+			}
+		}
+	}
+}
+
+Tid
+thread_preempt()
+{
+	int e = interrupts_off();
+	struct worker *w = current_worker();
+	struct thread *t = get_thread(running_thread);
+	Tid ret = THREAD_NONE;
+
+	trace_record(TRACE_TICK, t->Tid, THREAD_NONE, 0);
+	/* killed while running on another worker */
+	if (t->killed){
+		thread_exit(-SIGKILL);
+	}
+	/* the running thread used its whole quantum, but it is not demoted
+	 * below the priority it inherits */
+	boost_sync(t);
+	if (t->prio < THREAD_PRIO_LOWEST && t->prio < t->pi_prio){
+		++t->prio;
+	}
+	timer_advance();
+	/* notice ready fds even if the ready queues never drain */
+	if (num_io_waiters > 0 && !io_poller_idle &&
+	    ++io_ticks >= IO_POLL_TICKS){
+		struct timespec zero = {0, 0};
+		io_ticks = 0;
+		io_poll(&zero, false);
+	}
+	/* every worker's timer ticks */
+	if (++ticks_since_boost >= PRIO_BOOST_TICKS * num_workers){
+		ticks_since_boost = 0;
+		if (sched_fair){
+			fair_credit_update();
+		} else {
+			priority_boost();
+			boost_sync(t);
+		}
+	}
+	/* keep running if every thread ready on this worker has a lower
+	 * priority, or under THREAD_SCHED_FAIR, has had more CPU time */
+	if (sched_fair ? w->fair_queue.size != 0 &&
+	    vruntime_before(w->fair_heap[0]->vruntime, fair_vruntime(t, __rdtsc()))
+	    : w->ready_levels != 0 && __builtin_ctz(w->ready_levels) <= t->prio){
+		t->pinned = true;
+		ret = thread_yield(THREAD_ANY);
+		t->pinned = false;
+	}
+	interrupts_set(e);
+	return ret;
+}
+
+/**************************************************************************
+ * Important: The rest of the code should be implemented in Assignment 2. *
+ **************************************************************************/
+
+/* make sure to fill the wait_queue structure defined above */
+struct wait_queue *
+wait_queue_create()
+{
+	int e = interrupts_off();
+	struct wait_queue *wq;
+	wq = malloc369(sizeof(struct wait_queue));
+	assert(wq);
+
+	wq->threads.head = NULL;
+	wq->threads.tail = NULL;
+	wq->threads.size = 0;
+	wq->threads.worker = NULL;
+	wq->threads.level = 0;
+
+	interrupts_set(e);
+	return wq;
+}
+
+void
+put_to_sleep(struct wait_queue *wq, Tid thread_id){
+	int e = interrupts_off();
+	get_thread(running_thread)->sleeping = true;
+	queue_push_tail(&wq->threads, get_thread(thread_id));
+	interrupts_set(e);
+}
+
+/* Takes sleeping thread t off its wait queue, cancels its timeout, and makes
+ * it runnable. */
+void
+wakeup_thread(struct thread *t){
+	if (t->queue != NULL){
+		queue_remove(t);
+	}
+	if (t->timer.slot != NULL){
+		timer_cancel(t);
+	}
+	t->sleeping = false;
+	t->waiting_on = (Tid)-300;
+	/* a timer can expire in the thread_yield of the thread that is on its
+	 * way to sleep, which then just keeps running */
+	if (t->Tid == running_thread){
+		return;
+	}
+	trace_record(TRACE_WAKEUP, t->Tid, running_thread, 0);
+	acct_enter(t, ACCT_READY, __rdtsc());
+	ready_push(current_worker(), t);
+}
+
+int
+wakeup(struct wait_queue *wq){
+	int e = interrupts_off();
+	if (wq == NULL || wq->threads.head == NULL){
+		interrupts_set(e);
+		return 0;
+	}
+	wakeup_thread(wq->threads.head);
+	interrupts_set(e);
+	return 1;
+}
+
+int 
+wakeup_all(struct wait_queue *wq){
+	int e = interrupts_off();
+	if (wq == NULL){
+		interrupts_set(e);
+		return 0;
+	}
+	int count = 0;
+	while (wq->threads.head != NULL){
+		wakeup_thread(wq->threads.head);
+		++count;
+	}
+	interrupts_set(e);
+	return count;
+}
+
+void
+wait_queue_destroy(struct wait_queue *wq)
+{
+	int e = interrupts_off();
+	if (wq != NULL) {
+		assert (wq->threads.head == NULL);
+		assert (wq->threads.size == 0);
+	}
+	free369(wq);
+	wq = NULL;
+	interrupts_set(e);
+}
+
+Tid
+thread_sleep(struct wait_queue *queue)
+{
+	int e = interrupts_off();
+	/* ERROR CHECK*/
+	if (queue == NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (num_ready == 0 && !other_workers_busy() && num_timers == 0 &&
+		   num_io_waiters == 0){
+		interrupts_set(e);
+		return THREAD_NONE;
+	}
+	/* a thread that blocks before its quantum is up is interactive */
+	struct thread *t = get_thread(running_thread);
+	boost_sync(t);
+	if (t->prio > t->base_prio){
+		--t->prio;
+	}
+	/* PUT RUNNING_THREAD in WAIT QUEUE */
+	put_to_sleep(queue, running_thread);
+	assert (queue != NULL);
+	/* THREAD YIELD(THREAD_ANY)
+	   - make sure you don't place running thread back into ready_queue
+	   - set up flag sleeping in thread, and when thread_sleep is called place it to true
+	   - in thread_yield check if thread is sleeping, and thread->sleeping == false place it the ready queue
+	   - do we ever place the only running_thread to sleep???
+	*/
+	assert (queue != NULL);
+	Tid yielded = thread_yield(THREAD_ANY);
+	assert (queue != NULL);
+	interrupts_set(e);
+	return yielded;
+}
+
+/* Sleeps on queue, for a primitive obj that is handed directly to the thread
+ * that it wakes up, so returning means obj is ours. If we are killed after
+ * obj was handed to us but before we run, abandon(obj, tid) is called when
+ * we exit, to pass obj on. */
+void
+handoff_sleep(struct wait_queue *queue, void *obj, void (*abandon)(void *, Tid))
+{
+	struct thread *t = get_thread(running_thread);
+	Tid ret;
+
+	t->handoff_obj = obj;
+	t->handoff_abandon = abandon;
+	ret = thread_sleep(queue);
+	/* nobody else can run to hand obj over */
+	assert(ret != THREAD_NONE);
+	t->handoff_obj = NULL;
+}
+
+/* when the 'all' parameter is 1, wakeup all threads waiting in the queue.
+ * returns whether a thread was woken up on not. */
+int
+thread_wakeup(struct wait_queue *queue, int all)
+{
+	int e = interrupts_off();
+	int num_awoken;
+	if (all){
+		num_awoken = wakeup_all(queue);
+		interrupts_set(e);
+		return num_awoken;
+	} else {
+		num_awoken = wakeup(queue);
+		interrupts_set(e);
+		return num_awoken;
+	}
+	
+}
+
+/* Returns the bucket of addr. Multiplying by 2^64 / phi spreads nearby
+ * addresses, which differ only in their low bits, over the top bits. */
+struct park_queue **
+park_bucket(int *addr){
+	unsigned long h = (unsigned long)addr * 0x9e3779b97f4a7c15UL;
+	return &park_buckets[h >> (64 - PARK_BUCKET_BITS)];
+}
+
+/* Returns the queue of threads parked on addr, or NULL if there are none.
+ * Queues on the way that were emptied (by thread_kill, or by waking up
+ * their last thread) are put on the freelist. */
+struct park_queue *
+park_lookup(int *addr){
+	struct park_queue **link = park_bucket(addr);
+	struct park_queue *q;
+
+	while ((q = *link) != NULL){
+		if (q->wq.threads.head == NULL){
+			*link = q->next;
+			q->next = park_free;
+			park_free = q;
+		} else if (q->addr == addr){
+			return q;
+		} else {
+			link = &q->next;
+		}
+	}
+	return NULL;
+}
+
+int
+thread_park(int *addr, int expected)
+{
+	int e = interrupts_off();
+	struct park_queue *q;
+	Tid ret;
+
+	/* the waker changes *addr before it calls thread_unpark, which
+	 * cannot run until we are asleep */
+	if (__atomic_load_n(addr, __ATOMIC_RELAXED) != expected){
+		interrupts_set(e);
+		return 0;
+	}
+	q = park_lookup(addr);
+	if (q == NULL){
+		if (park_free != NULL){
+			q = park_free;
+			park_free = q->next;
+		} else {
+			q = malloc369(sizeof(struct park_queue));
+			assert(q);
+			/* an empty wait queue */
+			memset(&q->wq, 0, sizeof(q->wq));
+		}
+		q->addr = addr;
+		q->next = *park_bucket(addr);
+		*park_bucket(addr) = q;
+	}
+	ret = thread_sleep(&q->wq);
+	interrupts_set(e);
+	return ret == THREAD_NONE ? THREAD_NONE : 1;
+}
+
+int
+thread_unpark(int *addr, int n)
+{
+	int e = interrupts_off();
+	struct park_queue *q = park_lookup(addr);
+	int count = 0;
+
+	while (q != NULL && count < n && q->wq.threads.head != NULL){
+		wakeup_thread(q->wq.threads.head);
+		++count;
+	}
+	interrupts_set(e);
+	return count;
+}
+
+/* Returns the wait queues of fd, mapping its segment if it is the first fd
+ * in it to wait, and creates the epoll instance on first use. Returns NULL
+ * with errno set if that fails. */
+struct io_fd *
+io_fd_get(int fd){
+	if (fd < 0 || fd >= IO_MAX_FDS){
+		errno = EBADF;
+		return NULL;
+	}
+	if (io_epfd < 0){
+		struct epoll_event ev = {.events = EPOLLIN};
+		io_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (io_epfd < 0){
+			return NULL;
+		}
+		io_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		ev.data.fd = io_wakefd;
+		if (io_wakefd < 0 ||
+		    epoll_ctl(io_epfd, EPOLL_CTL_ADD, io_wakefd, &ev) != 0){
+			close(io_epfd);
+			io_epfd = -1;
+			return NULL;
+		}
+	}
+	struct io_fd **seg = &io_segments[fd >> IO_SEGMENT_BITS];
+	if (*seg == NULL){
+		/* zeroed wait queues are empty */
+		void *p = mmap(NULL, IO_SEGMENT * sizeof(struct io_fd),
+			       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			       -1, 0);
+		if (p == MAP_FAILED){
+			return NULL;
+		}
+		*seg = p;
+	}
+	return &(*seg)[fd & IO_SEGMENT_MASK];
+}
+
+/* Called after a call on fd failed with errno. If it would have blocked,
+ * sleeps until epoll reports fd readable (or writable) and returns true, so
+ * that the call is retried. Otherwise returns false, leaving errno set. */
+bool
+io_wait(int fd, bool writing){
+	if (errno != EAGAIN && errno != EWOULDBLOCK){
+		return false;
+	}
+	int e = interrupts_off();
+	struct io_fd *io = io_fd_get(fd);
+	if (io == NULL){
+		interrupts_set(e);
+		return false;
+	}
+	/* MOD re-arms the edge-triggered fd, so readiness that was reported
+	 * while no thread was waiting on it is reported again */
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+		.data.fd = fd
+	};
+	if (epoll_ctl(io_epfd, EPOLL_CTL_MOD, fd, &ev) != 0 &&
+	    (errno != ENOENT ||
+	     epoll_ctl(io_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)){
+		interrupts_set(e);
+		return false;
+	}
+	struct thread *t = get_thread(running_thread);
+	t->io_waiting = true;
+	++num_io_waiters;
+	thread_sleep(writing ? &io->writers : &io->readers);
+	t->io_waiting = false;
+	--num_io_waiters;
+	interrupts_set(e);
+	return true;
+}
+
+/* Wakes up the threads waiting on fds that are ready, waiting for one for
+ * up to timeout (forever if it is NULL). An idle worker releases the
+ * scheduler lock while it waits, and can be woken through io_wakefd. */
+void
+io_poll(struct timespec *timeout, bool idle){
+	struct epoll_event events[IO_EVENTS];
+
+	if (idle){
+		io_poller_idle = true;
+		++num_idle_workers;
+		if (num_workers > 1){
+			interrupts_unlock();
+		}
+	}
+	int n = epoll_pwait2(io_epfd, events, IO_EVENTS, timeout, NULL);
+	if (idle){
+		if (num_workers > 1){
+			interrupts_lock();
+		}
+		--num_idle_workers;
+		io_poller_idle = false;
+	}
+	for (int i = 0; i < n; i++){
+		int fd = events[i].data.fd;
+		if (fd == io_wakefd){
+			eventfd_t v;
+			eventfd_read(io_wakefd, &v);
+			continue;
+		}
+		struct io_fd *io = &io_segments[fd >> IO_SEGMENT_BITS][fd & IO_SEGMENT_MASK];
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+			wakeup_all(&io->readers);
+		}
+		if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)){
+			wakeup_all(&io->writers);
+		}
+	}
+}
+
+/* Puts fd in non-blocking mode, if it is not already. */
+int
+io_nonblock(int fd){
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0){
+		return -1;
+	}
+	if ((flags & O_NONBLOCK) == 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0){
+		return -1;
+	}
+	return 0;
+}
+
+ssize_t
+thread_read(int fd, void *buf, size_t count)
+{
+	ssize_t n;
+
+	if (io_nonblock(fd) != 0){
+		return -1;
+	}
+	while ((n = read(fd, buf, count)) < 0 && io_wait(fd, false)){
+	}
+	return n;
+}
+
+ssize_t
+thread_write(int fd, const void *buf, size_t count)
+{
+	ssize_t n;
+
+	if (io_nonblock(fd) != 0){
+		return -1;
+	}
+	while ((n = write(fd, buf, count)) < 0 && io_wait(fd, true)){
+	}
+	return n;
+}
+
+int
+thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	int ret;
+
+	if (io_nonblock(fd) != 0){
+		return -1;
+	}
+	while ((ret = accept4(fd, addr, addrlen, SOCK_NONBLOCK)) < 0 &&
+	       io_wait(fd, false)){
+	}
+	return ret;
+}
+
+/* suspend current thread until Thread tid exits */
+Tid
+thread_wait(Tid tid, int *exit_code)
+{
+	int e = interrupts_off();
+
+	/* ERROR CHECKING, RETURN THREAD INVALID*/
+	if (tid == running_thread) {
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (get_thread(tid) == NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	} else if (get_thread(tid)->wq != NULL){
+		if (get_thread(tid)->wq->threads.head != NULL){
+		interrupts_set(e);
+		return THREAD_INVALID;} 
+	} else if (get_thread(tid)->killed == true){
+		interrupts_set(e);
+		return THREAD_INVALID;
+	}
+
+	if (get_thread(tid)->exit == -300){
+		get_thread(running_thread)-> sleeping = true;
+	} else {get_thread(running_thread)-> sleeping = false;}
+
+	if (get_thread(running_thread)-> sleeping){
+		if (get_thread(tid)-> wq == NULL){
+			get_thread(tid)-> wq = wait_queue_create();
+		}
+		get_thread(running_thread)-> waiting_on = tid;
+		thread_sleep(get_thread(tid)-> wq);
+	}
+
+	// if this thread waited for a thread thaat has been killed, exit_code = -SIGKILL
+	assert(get_thread(tid)->exit != -300);
+	if (exit_code != NULL){*exit_code = get_thread(tid)->exit;}
+	thread_create_zombie(tid);
+	--num_threads_created;
+	thread_cleanup_zombie(get_thread(tid)->stack_freed);
+	assert (get_thread(running_thread)->waiting_on == -300);
+	interrupts_set(e);
+	return tid;
+}
+
+/* A contended lock_acquire yields at most this many times in LOCK_ADAPTIVE
+ * mode, while there are other threads to run, before it sleeps. */
+#define LOCK_ADAPTIVE_YIELDS 4
+
+struct lock {
+	struct wait_queue* wq;
+	Tid held_by;
+	bool free;
+	int flags;
+	struct lock_stats stats;
+	/* LOCK_PROFILE: when the holder acquired the lock */
+	long held_since;
+	char name[LOCK_NAME_LEN];
+	/* next lock held by the same thread, see pi_hold */
+	struct lock* held_next;
+	/* every lock that has not been destroyed, for lock_report */
+	struct lock* next;
+	struct lock* prev;
+};
+
+struct lock* lock_list = NULL;
+
+struct lock *
+lock_create()
+{
+	return lock_create_flags(0);
+}
+
+struct lock *
+lock_create_flags(int flags)
+{
+	return lock_create_named(NULL, flags);
+}
+
+struct lock *
+lock_create_named(const char *name, int flags)
+{
+	int e = interrupts_off();
+	struct lock *lock;
+
+	lock = malloc369(sizeof(struct lock));
+	assert(lock);
+	
+	lock ->wq = wait_queue_create();
+	lock->held_by = (Tid)-300;
+	lock->free = true;
+	lock->flags = lock_profile_all ? flags | LOCK_PROFILE : flags;
+	memset(&lock->stats, 0, sizeof(lock->stats));
+	lock->stats.max_hold_tid = -1;
+	lock->held_since = 0;
+	lock->held_next = NULL;
+	lock->name[0] = '\0';
+	if (name != NULL){
+		strncpy(lock->name, name, LOCK_NAME_LEN - 1);
+		lock->name[LOCK_NAME_LEN - 1] = '\0';
+	}
+	lock->prev = NULL;
+	lock->next = lock_list;
+	if (lock_list != NULL){
+		lock_list->prev = lock;
+	}
+	lock_list = lock;
+	interrupts_set(e);
+	return lock;
+}
+
+void
+lock_destroy(struct lock *lock)
+{
+	int e = interrupts_off();
+	assert(lock != NULL);
+	// check lock is available when it's destroyed
+	assert (lock->free);
+	wait_queue_destroy(lock->wq);
+	if (lock->prev == NULL){
+		lock_list = lock->next;
+	} else {
+		lock->prev->next = lock->next;
+	}
+	if (lock->next != NULL){
+		lock->next->prev = lock->prev;
+	}
+
+	free369(lock);
+	lock = NULL;
+	interrupts_set(e);
+}
+
+void
+lock_abandon(void *obj, Tid tid);
+
+/* Returns the histogram bucket of a time of ns nanoseconds, see
+ * LOCK_HIST_BUCKETS. */
+int
+lock_hist_bucket(long ns){
+	int b = 0;
+
+	if (ns >= 1L << LOCK_HIST_SHIFT){
+		b = 64 - __builtin_clzl(ns) - LOCK_HIST_SHIFT;
+	}
+	return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+}
+
+/* Charges lock with a contended acquisition that took waited ns. */
+void
+lock_waited(struct lock *lock, long waited){
+	lock->stats.wait_ns += waited;
+	if (waited > lock->stats.max_wait_ns){
+		lock->stats.max_wait_ns = waited;
+	}
+	if (lock->flags & LOCK_PROFILE){
+		++lock->stats.wait_hist[lock_hist_bucket(waited)];
+	}
+}
+
+/* Priority inheritance: a thread that waits for a lock passes its priority
+ * on to the holder, if that is lower, and on through the chain of locks
+ * that the holders in turn wait for, so that threads of middling priority
+ * cannot keep a high priority thread waiting by starving the holder of
+ * the CPU. A thread runs at the highest priority of the threads waiting
+ * for the locks it holds (its pi_prio) until it releases them, or they stop
+ * waiting, and is then put back at its own level. */
+#define PI_MAX_DEPTH 32
+
+/* Returns the highest priority of the threads waiting for lock, or
+ * THREAD_PRIO_LEVELS if none is. */
+int
+lock_waiters_prio(struct lock *lock){
+	int prio = THREAD_PRIO_LEVELS;
+
+	for (struct thread *w = lock->wq->threads.head; w != NULL; w = w->next){
+		boost_sync(w);
+		if (w->prio < prio){
+			prio = w->prio;
+		}
+	}
+	return prio;
+}
+
+/* Recomputes what t inherits from the waiters of the locks it holds, and
+ * moves it to the level it is now entitled to. */
+void
+pi_update(struct thread *t){
+	int prio = THREAD_PRIO_LEVELS;
+
+	for (struct lock *l = t->locks_held; l != NULL; l = l->held_next){
+		int p = lock_waiters_prio(l);
+		if (p < prio){
+			prio = p;
+		}
+	}
+	t->pi_prio = prio;
+	boost_sync(t);
+	int floor = prio_floor(t);
+	if (t->prio < floor || t->prio > prio){
+		set_level(t, floor);
+	}
+}
+
+/* Passes prio, the priority of a thread that is about to wait for lock, on
+ * to its holder, and on down the chain. A cycle is a deadlock, and only
+ * PI_MAX_DEPTH holders are visited. */
+void
+pi_propagate(struct lock *lock, int prio){
+	for (int depth = 0; lock != NULL && depth < PI_MAX_DEPTH; depth++){
+		struct thread *holder = get_thread(lock->held_by);
+		if (lock->free || holder == NULL){
+			break;
+		}
+		if (prio < holder->pi_prio){
+			holder->pi_prio = prio;
+		}
+		boost_sync(holder);
+		if (holder->prio <= prio){
+			break;
+		}
+		set_level(holder, prio);
+		lock = holder->waiting_lock;
+	}
+}
+
+/* Called when t becomes the holder of lock. It inherits the priority of
+ * the threads that were already waiting. */
+void
+pi_hold(struct thread *t, struct lock *lock){
+	lock->held_next = t->locks_held;
+	t->locks_held = lock;
+	if (lock->wq->threads.head != NULL){
+		int prio = lock_waiters_prio(lock);
+		if (prio < t->pi_prio){
+			t->pi_prio = prio;
+		}
+		boost_sync(t);
+		if (prio < t->prio){
+			set_level(t, prio);
+		}
+	}
+}
+
+/* Called when the holder of lock gives it up. */
+void
+pi_unhold(struct lock *lock){
+	struct thread *t = get_thread(lock->held_by);
+
+	if (t == NULL){
+		return;
+	}
+	for (struct lock **l = &t->locks_held; *l != NULL; l = &(*l)->held_next){
+		if (*l == lock){
+			*l = lock->held_next;
+			break;
+		}
+	}
+	lock->held_next = NULL;
+	if (t->pi_prio < THREAD_PRIO_LEVELS){
+		pi_update(t);
+	}
+}
+
+/* Called when a thread stops waiting for lock without acquiring it. */
+void
+pi_leave(struct lock *lock){
+	struct thread *holder = get_thread(lock->held_by);
+
+	if (!lock->free && holder != NULL && holder->pi_prio < THREAD_PRIO_LEVELS){
+		pi_update(holder);
+	}
+}
+
+/* Called when the running thread has acquired lock. */
+void
+lock_taken(struct lock *lock){
+	/* a lock handed over by lock_pass is already ours */
+	if (lock->free){
+		pi_hold(get_thread(running_thread), lock);
+	}
+	lock->held_by = running_thread;
+	lock->free = false;
+	if (lock->flags & LOCK_PROFILE){
+		lock->held_since = clock_ns();
+	}
+}
+
+void
+lock_acquire(struct lock *lock)
+{
+	int e = interrupts_off();
+	assert(lock != NULL);
+	++lock->stats.acquires;
+	if (!lock->free){
+		long start = clock_ns();
+		int yields = 0;
+
+		++lock->stats.contended;
+		trace_record(TRACE_LOCK_CONTEND, running_thread, lock->held_by,
+			     (long) lock);
+		/* the holder may be about to release the lock, so give it a
+		 * chance to run before paying for a sleep and a wakeup */
+		if (lock->flags & LOCK_ADAPTIVE){
+			while (!lock->free && yields < LOCK_ADAPTIVE_YIELDS
+			       && num_ready > 0){
+				thread_yield(THREAD_ANY);
+				++yields;
+			}
+			lock->stats.yields += yields;
+		}
+		get_thread(running_thread)->handoff_obj = lock;
+		get_thread(running_thread)->handoff_abandon = lock_abandon;
+		get_thread(running_thread)->waiting_lock = lock;
+		/* in LOCK_HANDOFF mode lock_release makes us the holder
+		 * before waking us up */
+		while (!lock->free && lock->held_by != running_thread){
+			pi_propagate(lock, get_thread(running_thread)->prio);
+			thread_sleep(lock->wq);
+		}
+		get_thread(running_thread)->handoff_obj = NULL;
+		get_thread(running_thread)->waiting_lock = NULL;
+		lock_waited(lock, clock_ns() - start);
+	}
+	lock_taken(lock);
+	interrupts_set(e);
+}
+
+int
+lock_acquire_timeout(struct lock *lock, unsigned long usecs)
+{
+	int e = interrupts_off();
+	struct thread *t = get_thread(running_thread);
+	assert(lock != NULL);
+	if (!lock->free){
+		long start = clock_ns();
+
+		trace_record(TRACE_LOCK_CONTEND, running_thread, lock->held_by,
+			     (long) lock);
+		timer_arm(t, usecs);
+		t->handoff_obj = lock;
+		t->handoff_abandon = lock_abandon;
+		t->waiting_lock = lock;
+		while (!lock->free && lock->held_by != running_thread
+		       && !t->timed_out){
+			pi_propagate(lock, t->prio);
+			thread_sleep(lock->wq);
+		}
+		t->handoff_obj = NULL;
+		t->waiting_lock = NULL;
+		if (t->timer.slot != NULL){
+			timer_cancel(t);
+		}
+		if (!lock->free && lock->held_by != running_thread){
+			/* the holder no longer inherits from us */
+			pi_leave(lock);
+			interrupts_set(e);
+			return 0;
+		}
+		/* like acquires, only waits that got the lock are counted */
+		++lock->stats.contended;
+		lock_waited(lock, clock_ns() - start);
+	}
+	++lock->stats.acquires;
+	lock_taken(lock);
+	interrupts_set(e);
+	return 1;
+}
+
+/* Releases lock on behalf of its holder. In LOCK_HANDOFF mode the lock goes
+ * straight to the first waiter, so no other thread can barge in before the
+ * waiter runs. Otherwise the lock is freed and the first waiter is woken up
+ * to retry. */
+void
+lock_pass(struct lock *lock)
+{
+	struct thread *next = lock->wq->threads.head;
+
+	pi_unhold(lock);
+	if ((lock->flags & LOCK_HANDOFF) && next != NULL){
+		lock->held_by = next->Tid;
+		lock->free = false;
+		++lock->stats.handoffs;
+		wakeup_thread(next);
+		pi_hold(next, lock);
+		return;
+	}
+	lock->held_by = (Tid)-300;
+	lock->free = true;
+	thread_wakeup(lock->wq, false);
+}
+
+void
+lock_release(struct lock *lock)
+{
+	int e = interrupts_off();
+
+	if ((lock->flags & LOCK_PROFILE) && lock->held_by == running_thread){
+		long held = clock_ns() - lock->held_since;
+
+		++lock->stats.holds;
+		lock->stats.hold_ns += held;
+		if (held > lock->stats.max_hold_ns){
+			lock->stats.max_hold_ns = held;
+			lock->stats.max_hold_tid = running_thread;
+		}
+		++lock->stats.hold_hist[lock_hist_bucket(held)];
+	}
+	lock_pass(lock);
+
+	interrupts_set(e);
+}
+
+/* Called when thread tid exits while it waits for lock. If the lock was
+ * handed to it, but it was killed before it ran, the lock is passed on. */
+void
+lock_abandon(void *obj, Tid tid)
+{
+	struct lock *lock = obj;
+
+	if (lock->held_by == tid){
+		lock_pass(lock);
+	} else {
+		pi_leave(lock);
+	}
+}
+
+void
+lock_get_stats(struct lock *lock, struct lock_stats *stats)
+{
+	int e = interrupts_off();
+	assert(lock != NULL);
+	assert(stats != NULL);
+	*stats = lock->stats;
+	interrupts_set(e);
+}
+
+/* Orders locks by contended acquisitions, then by total wait time, then
+ * by acquisitions, most first. */
+int
+lock_report_cmp(const void *a, const void *b){
+	const struct lock *x = *(struct lock * const *) a;
+	const struct lock *y = *(struct lock * const *) b;
+
+	if (x->stats.contended != y->stats.contended){
+		return x->stats.contended < y->stats.contended ? 1 : -1;
+	}
+	if (x->stats.wait_ns != y->stats.wait_ns){
+		return x->stats.wait_ns < y->stats.wait_ns ? 1 : -1;
+	}
+	if (x->stats.acquires != y->stats.acquires){
+		return x->stats.acquires < y->stats.acquires ? 1 : -1;
+	}
+	return 0;
+}
+
+/* Prints the non-empty buckets of a histogram, labelled with their upper
+ * bounds, if there are any. */
+void
+lock_report_hist(const char *what, const unsigned long *hist){
+	int i;
+
+	for (i = 0; i < LOCK_HIST_BUCKETS && hist[i] == 0; i++){
+	}
+	if (i == LOCK_HIST_BUCKETS){
+		return;
+	}
+	printf("    %s:", what);
+	for (; i < LOCK_HIST_BUCKETS; i++){
+		long bound = 1L << (LOCK_HIST_SHIFT + i);
+		if (hist[i] == 0){
+			continue;
+		}
+		if (i == LOCK_HIST_BUCKETS - 1){
+			printf(" >=%ldms:%lu", (bound / 2) / 1000000, hist[i]);
+		} else if (bound < 10000){
+			printf(" <%ldns:%lu", bound, hist[i]);
+		} else if (bound < 10000000){
+			printf(" <%ldus:%lu", bound / 1000, hist[i]);
+		} else {
+			printf(" <%ldms:%lu", bound / 1000000, hist[i]);
+		}
+	}
+	printf("\n");
+}
+
+void
+lock_report(int n)
+{
+	int e = interrupts_off();
+	struct lock **locks;
+	struct lock *lock;
+	int nlocks = 0;
+	char name[LOCK_NAME_LEN + 32];
+
+	for (lock = lock_list; lock != NULL; lock = lock->next){
+		++nlocks;
+	}
+	locks = malloc369((nlocks + 1) * sizeof(struct lock *));
+	assert(locks);
+	nlocks = 0;
+	for (lock = lock_list; lock != NULL; lock = lock->next){
+		locks[nlocks++] = lock;
+	}
+	qsort(locks, nlocks, sizeof(struct lock *), lock_report_cmp);
+	printf("%-*s %10s %10s %6s %12s %10s %12s %10s %8s %8s\n",
+	       LOCK_NAME_LEN - 1, "lock",
+	       "acquires", "contended", "cont%", "wait_us", "max_wait",
+	       "hold_us", "max_hold", "holder", "cv_waits");
+	for (int i = 0; i < nlocks && i < n; i++){
+		struct lock_stats *st = &locks[i]->stats;
+		bool profiled = locks[i]->flags & LOCK_PROFILE;
+
+		if (locks[i]->name[0] != '\0'){
+			snprintf(name, sizeof(name), "%s", locks[i]->name);
+		} else {
+			snprintf(name, sizeof(name), "%p", (void *) locks[i]);
+		}
+		printf("%-*s %10lu %10lu %6.1f %12ld %10ld", LOCK_NAME_LEN - 1, name,
+		       st->acquires, st->contended,
+		       st->acquires > 0 ? 100.0 * st->contended / st->acquires : 0.0,
+		       st->wait_ns / 1000, st->max_wait_ns / 1000);
+		if (profiled){
+			printf(" %12ld %10ld %8d", st->hold_ns / 1000,
+			       st->max_hold_ns / 1000, st->max_hold_tid);
+		} else {
+			printf(" %12s %10s %8s", "-", "-", "-");
+		}
+		printf(" %8lu\n", st->cv_waits);
+		if (profiled){
+			lock_report_hist("wait", st->wait_hist);
+			lock_report_hist("hold", st->hold_hist);
+		}
+	}
+	fflush(stdout);
+	free369(locks);
+	interrupts_set(e);
+}
+
+struct cv {
+	bool condition_reach;
+	struct wait_queue* wq;
+	int num_waiting;
+};
+
+struct cv *
+cv_create()
+{
+	int e = interrupts_off();
+	struct cv *cv;
+	cv = malloc369(sizeof(struct cv));
+	assert(cv);
+
+	cv->condition_reach = true;
+	cv-> wq = wait_queue_create();
+	cv->num_waiting = 0;
+
+	interrupts_set(e);
+	return cv;
+}
+
+void
+cv_destroy(struct cv *cv)
+{
+	int e = interrupts_off();
+	assert(cv != NULL);
+	assert (cv->wq != NULL);
+	free369(cv->wq);
+	cv->wq = NULL;
+	free369(cv);
+	interrupts_set(e);
+}
+
+void
+cv_wait(struct cv *cv, struct lock *lock)
+{
+	assert(cv != NULL);
+	assert(lock != NULL);
+
+	if (lock->held_by != running_thread){
+		printf("thread doesn't hold the lock, can't execute cv_wait");
+		return;}
+	assert (lock->held_by == running_thread);
+	/* interrupts stay off from the release until we are on the cv's wait
+	 * queue, or a cv_signal in between would be lost */
+	int e = interrupts_off();
+	++lock->stats.cv_waits;
+	lock_release(lock);
+	++cv->num_waiting;
+	thread_sleep(cv->wq);
+	lock_acquire(lock);
+	interrupts_set(e);
+}
+
+int
+cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned long usecs)
+{
+	int e = interrupts_off();
+	struct thread *t = get_thread(running_thread);
+	assert(cv != NULL);
+	assert(lock != NULL);
+	assert(lock->held_by == running_thread);
+
+	++lock->stats.cv_waits;
+	lock_release(lock);
+	++cv->num_waiting;
+	timer_arm(t, usecs);
+	thread_sleep(cv->wq);
+	int timed_out = t->timed_out;
+	if (timed_out){
+		--cv->num_waiting;
+	}
+	lock_acquire(lock);
+	interrupts_set(e);
+	return !timed_out;
+}
+
+void
+cv_signal(struct cv *cv, struct lock *lock)
+{
+	int e = interrupts_off();
+	assert(cv != NULL);
+	assert(lock != NULL);
+	if (cv->wq->threads.head == NULL){
+		interrupts_set(e);
+		return;}
+	Tid thread_id = cv->wq->threads.head->Tid;
+	--cv->num_waiting;
+	//interrupts_set(e);
+	thread_wakeup(cv->wq, false);
+	assert(lock->held_by != thread_id);
+	interrupts_set(e);
+}
+
+void
+cv_broadcast(struct cv *cv, struct lock *lock)
+{
+	int e = interrupts_off();
+	assert(cv != NULL);
+	assert(lock != NULL);
+	cv->num_waiting = 0;
+	thread_wakeup(cv->wq, true);
+	assert (cv->wq->threads.head == NULL);
+	interrupts_set(e);
+	//submitted
+}
+
+/* A reader-writer lock. Readers share the lock, and writers hold it
+ * exclusively. The lock is handed over directly on unlock, like a
+ * LOCK_HANDOFF lock: a thread woken from one of the wait queues already
+ * holds the lock. A reader that arrives while a writer holds or waits for
+ * the lock queues up, so a stream of readers cannot starve the writers. A
+ * writer that unlocks hands the lock to all the queued readers at once, with
+ * a single thread_wakeup, so the writers cannot starve the readers either.
+ */
+struct rwlock {
+	struct wait_queue* readers;
+	struct wait_queue* writers;
+	int nreaders;		/* readers holding the lock */
+	Tid writer;		/* the writer holding the lock, or -300 */
+};
+
+struct rwlock *
+rwlock_create()
+{
+	int e = interrupts_off();
+	struct rwlock *rw;
+
+	rw = malloc369(sizeof(struct rwlock));
+	assert(rw);
+	rw->readers = wait_queue_create();
+	rw->writers = wait_queue_create();
+	rw->nreaders = 0;
+	rw->writer = (Tid)-300;
+	interrupts_set(e);
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	int e = interrupts_off();
+	assert(rw != NULL);
+	assert(rw->nreaders == 0 && rw->writer == (Tid)-300);
+	wait_queue_destroy(rw->readers);
+	wait_queue_destroy(rw->writers);
+	free369(rw);
+	interrupts_set(e);
+}
+
+void
+rwlock_abandon(void *obj, Tid tid);
+
+void
+rwlock_rdlock(struct rwlock *rw)
+{
+	int e = interrupts_off();
+	assert(rw != NULL);
+	if (rw->writer == (Tid)-300 && rw->writers->threads.head == NULL){
+		++rw->nreaders;
+	} else {
+		/* the writer that wakes us counts us in nreaders */
+		handoff_sleep(rw->readers, rw, rwlock_abandon);
+	}
+	interrupts_set(e);
+}
+
+void
+rwlock_wrlock(struct rwlock *rw)
+{
+	int e = interrupts_off();
+	assert(rw != NULL);
+	if (rw->writer == (Tid)-300 && rw->nreaders == 0){
+		rw->writer = running_thread;
+	} else {
+		/* the thread that wakes us makes us the writer */
+		handoff_sleep(rw->writers, rw, rwlock_abandon);
+		assert(rw->writer == running_thread);
+	}
+	interrupts_set(e);
+}
+
+/* Releases rw on behalf of thread tid, which holds it. */
+void
+rwlock_unlock_for(struct rwlock *rw, Tid tid)
+{
+	struct thread *next;
+
+	if (rw->writer == tid){
+		rw->writer = (Tid)-300;
+		if (rw->readers->threads.head != NULL){
+			rw->nreaders = rw->readers->threads.size;
+			thread_wakeup(rw->readers, true);
+			return;
+		}
+	} else {
+		assert(rw->nreaders > 0);
+		if (--rw->nreaders > 0){
+			return;
+		}
+	}
+	next = rw->writers->threads.head;
+	if (next != NULL){
+		rw->writer = next->Tid;
+		wakeup_thread(next);
+	}
+}
+
+void
+rwlock_abandon(void *obj, Tid tid)
+{
+	rwlock_unlock_for(obj, tid);
+}
+
+void
+rwlock_unlock(struct rwlock *rw)
+{
+	int e = interrupts_off();
+	assert(rw != NULL);
+	rwlock_unlock_for(rw, running_thread);
+	interrupts_set(e);
+}
+
+/* A counting semaphore. semaphore_up hands the unit straight to the first
+ * sleeping thread, if there is one, instead of incrementing value, so a woken
+ * thread never has to check the count again. */
+struct semaphore {
+	struct wait_queue* wq;
+	int value;
+};
 
-/* make sure to fill the wait_queue structure defined above */
-struct wait_queue *
-wait_queue_create()
+struct semaphore *
+semaphore_create(int value)
 {
 	int e = interrupts_off();
-	struct wait_queue *wq;
-	wq = malloc369(sizeof(struct wait_queue));
-	assert(wq);
+	struct semaphore *sem;
 
-	// wq->head = malloc369(sizeof(struct waiting_thread));
-	// wq->tail = malloc369(sizeof(struct waiting_thread));
-	wq->head = NULL;
-	wq->tail = NULL;
-	wq->size = 0;
+	assert(value >= 0);
+	sem = malloc369(sizeof(struct semaphore));
+	assert(sem);
+	sem->wq = wait_queue_create();
+	sem->value = value;
+	interrupts_set(e);
+	return sem;
+}
 
+void
+semaphore_destroy(struct semaphore *sem)
+{
+	int e = interrupts_off();
+	assert(sem != NULL);
+	wait_queue_destroy(sem->wq);
+	free369(sem);
 	interrupts_set(e);
-	return wq;
 }
 
+/* Returns the unit that a thread which exited before it ran was handed. */
 void
-put_to_sleep(struct wait_queue *wq, Tid thread_id){
+semaphore_abandon(void *obj, Tid tid)
+{
+	semaphore_up(obj);
+}
+
+void
+semaphore_down(struct semaphore *sem)
+{
 	int e = interrupts_off();
-	created_threads[(int) running_thread]->sleeping = true;
-	struct waiting_thread *waiting = malloc369(sizeof(struct waiting_thread));
-	waiting->data = thread_id;
-	waiting->next = NULL;
-	if (wq->head == NULL){
-		wq->head = waiting;
-		wq->tail = waiting;
+	assert(sem != NULL);
+	if (sem->value > 0){
+		--sem->value;
 	} else {
-		wq->tail->next = waiting;
-		wq->tail = waiting;
+		handoff_sleep(sem->wq, sem, semaphore_abandon);
 	}
-	++ wq->size;
 	interrupts_set(e);
 }
 
-int
-wakeup(struct wait_queue *wq){
+void
+semaphore_up(struct semaphore *sem)
+{
 	int e = interrupts_off();
-	if (wq == NULL || wq->head == NULL){
-		interrupts_set(e);
-		return 0;
+	assert(sem != NULL);
+	if (sem->wq->threads.head != NULL){
+		wakeup_thread(sem->wq->threads.head);
 	} else {
-		struct waiting_thread *first_out = wq->head;
-		Tid awoken_thread = first_out->data;
-		created_threads[(int) awoken_thread]->sleeping = false;
-		created_threads[(int) awoken_thread] -> waiting_on = (Tid)-300;
-		add_to_queue_tail(awoken_thread);
-
-		--wq->size;
-		wq->head = first_out->next;
-		if (wq->head == NULL){ wq->tail = NULL;}
-
-		free369(first_out);
-		first_out = NULL;
-		assert (wq != NULL);
-
-		interrupts_set(e);
-		return 1;
+		++sem->value;
 	}
+	interrupts_set(e);
 }
 
-int 
-wakeup_all(struct wait_queue *wq){
+/* A reusable barrier for a fixed number of threads. The last thread to
+ * arrive wakes all the others at once and resets the count, so the barrier
+ * is ready for the next phase as soon as it returns. */
+struct barrier {
+	struct wait_queue* wq;
+	int nthreads;
+	int arrived;
+};
+
+struct barrier *
+barrier_create(int nthreads)
+{
 	int e = interrupts_off();
-	if (wq == NULL){
-		interrupts_set(e);
-		return 0;
-	}
-	int count = 0;
-	while (wq->size > 0){
-		count = count + wakeup(wq);
-	}
+	struct barrier *b;
+
+	assert(nthreads > 0);
+	b = malloc369(sizeof(struct barrier));
+	assert(b);
+	b->wq = wait_queue_create();
+	b->nthreads = nthreads;
+	b->arrived = 0;
 	interrupts_set(e);
-	return count;
+	return b;
 }
 
 void
-wait_queue_destroy(struct wait_queue *wq)
+barrier_destroy(struct barrier *b)
 {
 	int e = interrupts_off();
-	if (wq != NULL) {
-		assert (wq->head == NULL);
-		assert (wq->size == 0);
-	}
-	free369(wq);
-	wq = NULL;
+	assert(b != NULL);
+	assert(b->arrived == 0);
+	wait_queue_destroy(b->wq);
+	free369(b);
 	interrupts_set(e);
 }
 
-Tid
-thread_sleep(struct wait_queue *queue)
+int
+barrier_wait(struct barrier *b)
 {
 	int e = interrupts_off();
-	/* ERROR CHECK*/
-	if (queue == NULL){
-		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (ready_queue[0] == (Tid)-300){
+	assert(b != NULL);
+	if (++b->arrived < b->nthreads){
+		thread_sleep(b->wq);
 		interrupts_set(e);
-		return THREAD_NONE;
+		return 0;
 	}
-	/* PUT RUNNING_THREAD in WAIT QUEUE */
-	put_to_sleep(queue, running_thread);
-	assert (queue != NULL);
-	/* THREAD YIELD(THREAD_ANY)
-	   - make sure you don't place running thread back into ready_queue
-	   - set up flag sleeping in thread, and when thread_sleep is called place it to true
-	   - in thread_yield check if thread is sleeping, and thread->sleeping == false place it the ready queue
-	   - do we ever place the only running_thread to sleep???
-	*/
-	assert (queue != NULL);
-	Tid yielded = thread_yield(THREAD_ANY);
-	assert (queue != NULL);
+	b->arrived = 0;
+	wakeup_all(b->wq);
 	interrupts_set(e);
-	return yielded;
+	return 1;
 }
 
-/* when the 'all' parameter is 1, wakeup all threads waiting in the queue.
- * returns whether a thread was woken up on not. */
-int
-thread_wakeup(struct wait_queue *queue, int all)
+/* A bounded channel of pointers. The buffer is a ring of capacity slots.
+ * Receivers only wait while the buffer is empty, and senders only while it
+ * is full, so a message is never buffered when it can go straight to a
+ * thread: a sender hands it to the first waiting receiver through the
+ * receiver's chan_msg, and a receiver takes a waiting sender's message, into
+ * the slot it just freed or, with no buffer, directly. chan_done tells a
+ * woken thread whether its message went through or the channel was closed.
+ *
+ * The sender keeps running after a handoff rather than switching to the
+ * receiver, so that it can fill the buffer and the receiver then drains it
+ * in one go (see bench_pipeline). A receiver killed after it was handed a
+ * message, but before it ran, passes the message on when it exits (see
+ * handoff_sleep), to the next receiver or to the front of the buffer, which
+ * grows past capacity if it has to. */
+struct chan {
+	void** buf;
+	int size;		/* slots in buf, normally capacity */
+	int head;
+	int count;
+	int capacity;
+	bool closed;
+	struct wait_queue* senders;
+	struct wait_queue* receivers;
+};
+
+struct chan *
+chan_create(int capacity)
 {
 	int e = interrupts_off();
-	int num_awoken;
-	if (all){
-		num_awoken = wakeup_all(queue);
-		interrupts_set(e);
-		return num_awoken;
-	} else {
-		num_awoken = wakeup(queue);
-		interrupts_set(e);
-		return num_awoken;
+	struct chan *ch;
+
+	assert(capacity >= 0);
+	ch = malloc369(sizeof(struct chan));
+	assert(ch);
+	ch->buf = NULL;
+	if (capacity > 0){
+		ch->buf = malloc369(capacity * sizeof(void *));
+		assert(ch->buf);
 	}
-	
+	ch->size = capacity;
+	ch->head = 0;
+	ch->count = 0;
+	ch->capacity = capacity;
+	ch->closed = false;
+	ch->senders = wait_queue_create();
+	ch->receivers = wait_queue_create();
+	interrupts_set(e);
+	return ch;
 }
 
-/* suspend current thread until Thread tid exits */
-Tid
-thread_wait(Tid tid, int *exit_code)
+void
+chan_destroy(struct chan *ch)
 {
 	int e = interrupts_off();
+	assert(ch != NULL);
+	wait_queue_destroy(ch->senders);
+	wait_queue_destroy(ch->receivers);
+	free369(ch->buf);
+	free369(ch);
+	interrupts_set(e);
+}
 
-	/* ERROR CHECKING, RETURN THREAD INVALID*/
-	if ((int) tid < 0 || (int) tid>=THREAD_MAX_THREADS){
-		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (tid == running_thread) {
-		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (created_threads[(int)tid]== NULL){
-		interrupts_set(e);
-		return THREAD_INVALID;
-	} else if (created_threads[(int)tid]->wq != NULL){
-		if (created_threads[(int)tid]->wq->head != NULL){
-		interrupts_set(e);
-		return THREAD_INVALID;} 
-	} else if (created_threads[(int)tid]->killed == true){
-		interrupts_set(e);
-		return THREAD_INVALID;
-	}
+/* Appends msg to the buffer, which must have room. */
+void
+chan_push(struct chan *ch, void *msg){
+	ch->buf[(ch->head + ch->count) % ch->size] = msg;
+	++ch->count;
+}
 
-	if (created_threads[(int)tid]->exit == -300){
-		created_threads[(int) running_thread]-> sleeping = true;
-	} else {created_threads[(int) running_thread]-> sleeping = false;}
+void *
+chan_pop(struct chan *ch){
+	void *msg = ch->buf[ch->head];
+	ch->head = (ch->head + 1) % ch->size;
+	--ch->count;
+	return msg;
+}
 
-	if (created_threads[(int) running_thread]-> sleeping){
-		if (created_threads[(int) tid]-> wq == NULL){
-			created_threads[(int) tid]-> wq = wait_queue_create();
+/* Passes on the message handed to receiver tid, which exited before it
+ * ran. */
+void
+chan_abandon(void *obj, Tid tid)
+{
+	struct chan *ch = obj;
+	struct thread *t = get_thread(tid);
+	struct thread *r = ch->receivers->threads.head;
+
+	if (r != NULL){
+		r->chan_msg = t->chan_msg;
+		r->chan_done = true;
+		wakeup_thread(r);
+		return;
+	}
+	if (ch->count == ch->size){
+		int size = ch->size > 0 ? 2 * ch->size : 1;
+		void **buf = malloc369(size * sizeof(void *));
+		assert(buf);
+		for (int i = 0; i < ch->count; i++){
+			buf[i] = ch->buf[(ch->head + i) % ch->size];
 		}
-		created_threads[(int) running_thread]-> waiting_on = tid;
-		thread_sleep(created_threads[(int) tid]-> wq);
+		free369(ch->buf);
+		ch->buf = buf;
+		ch->size = size;
+		ch->head = 0;
 	}
-
-	// if this thread waited for a thread thaat has been killed, exit_code = -SIGKILL
-	assert(created_threads[(int)tid]->exit != -300);
-	if (exit_code != NULL){*exit_code = created_threads[(int)tid]->exit;}
-	thread_create_zombie(tid);
-	--num_threads_created;
-	thread_cleanup_zombie(created_threads[(int)tid]->stack_freed);
-	assert (created_threads[(int)running_thread]->waiting_on == -300);
-	interrupts_set(e);
-	return tid;
+	/* it was sent before anything in the buffer */
+	ch->head = (ch->head + ch->size - 1) % ch->size;
+	ch->buf[ch->head] = t->chan_msg;
+	++ch->count;
 }
 
-struct lock {
-	struct wait_queue* wq;
-	Tid held_by;
-	bool free;
-};
-
-struct lock *
-lock_create()
+int
+chan_send(struct chan *ch, void *msg)
 {
 	int e = interrupts_off();
-	struct lock *lock;
+	struct thread *t;
+	Tid ret;
 
-	lock = malloc369(sizeof(struct lock));
-	assert(lock);
-	
-	lock ->wq = wait_queue_create();
-	lock->held_by = (Tid)-300;
-	lock->free = true;
+	assert(ch != NULL);
+	if (ch->closed){
+		interrupts_set(e);
+		return 0;
+	}
+	if ((t = ch->receivers->threads.head) != NULL){
+		t->chan_msg = msg;
+		t->chan_done = true;
+		wakeup_thread(t);
+	} else if (ch->count < ch->capacity){
+		chan_push(ch, msg);
+	} else {
+		t = get_thread(running_thread);
+		t->chan_msg = msg;
+		t->chan_done = false;
+		ret = thread_sleep(ch->senders);
+		/* nobody else can run to receive it */
+		assert(ret != THREAD_NONE);
+		if (!t->chan_done){
+			interrupts_set(e);
+			return 0;
+		}
+	}
 	interrupts_set(e);
-	return lock;
+	return 1;
 }
 
-void
-lock_destroy(struct lock *lock)
+int
+chan_recv(struct chan *ch, void **msg)
 {
 	int e = interrupts_off();
-	assert(lock != NULL);
-	// check lock is available when it's destroyed
-	assert (lock->free);
-	wait_queue_destroy(lock->wq);
-
-	free369(lock);
-	lock = NULL;
+	struct thread *t;
+
+	assert(ch != NULL);
+	if (ch->count > 0){
+		*msg = chan_pop(ch);
+		/* the first waiting sender's message takes the freed slot */
+		if ((t = ch->senders->threads.head) != NULL){
+			chan_push(ch, t->chan_msg);
+			t->chan_done = true;
+			wakeup_thread(t);
+		}
+	} else if ((t = ch->senders->threads.head) != NULL){
+		*msg = t->chan_msg;
+		t->chan_done = true;
+		wakeup_thread(t);
+	} else if (ch->closed){
+		interrupts_set(e);
+		return 0;
+	} else {
+		t = get_thread(running_thread);
+		t->chan_done = false;
+		handoff_sleep(ch->receivers, ch, chan_abandon);
+		if (!t->chan_done){
+			interrupts_set(e);
+			return 0;
+		}
+		*msg = t->chan_msg;
+	}
 	interrupts_set(e);
+	return 1;
 }
 
 void
-lock_acquire(struct lock *lock)
+chan_close(struct chan *ch)
 {
 	int e = interrupts_off();
-	assert(lock != NULL);
-	while (!lock->free){
-		thread_sleep(lock->wq);
+	struct thread *t;
+
+	assert(ch != NULL);
+	ch->closed = true;
+	/* chan_done is false in each of them, and nothing was handed to them */
+	while ((t = ch->receivers->threads.head) != NULL){
+		t->handoff_obj = NULL;
+		wakeup_thread(t);
 	}
-	lock->held_by = running_thread;
-	lock->free = false;
+	wakeup_all(ch->senders);
 	interrupts_set(e);
 }
 
-void
-lock_release(struct lock *lock)
-{
-	int e = interrupts_off();
-
-	lock->held_by = (Tid)-300;
-	lock->free = true;
-	thread_wakeup(lock->wq, false);
-
-	interrupts_set(e);
-}
+/* A pool of long-lived threads that run submitted tasks. Each task is a
+ * future: pool_submit appends it to the pool's queue and wakes up an idle
+ * pool thread, which runs it and wakes the thread waiting in future_get, if
+ * any. Futures are recycled through the pool's freelist, so once the pool
+ * has warmed up a task costs a queue push and, at most, two wakeups. */
+struct future {
+	void* (*fn)(void *);
+	void* arg;
+	void* result;
+	bool done;
+	struct pool* pool;
+	struct future* next;		/* in the pool's queue or freelist */
+	struct wait_queue waiter;	/* the thread in future_get */
+};
 
-struct cv {
-	bool condition_reach;
-	struct wait_queue* wq;
-	int num_waiting;
+struct pool {
+	struct future* head;		/* queued tasks */
+	struct future* tail;
+	struct future* free;		/* futures to reuse */
+	struct wait_queue* idle;	/* pool threads with nothing to run */
+	Tid* threads;
+	int nthreads;
+	bool closing;
 };
 
-struct cv *
-cv_create()
+void
+pool_thread(void *arg)
 {
-	int e = interrupts_off();
-	struct cv *cv;
-	cv = malloc369(sizeof(struct cv));
-	assert(cv);
+	struct pool *pool = arg;
+	struct future *f;
+
+	for (;;){
+		int e = interrupts_off();
+		Tid ret = 0;
+		while ((f = pool->head) == NULL && !pool->closing
+		       && ret != THREAD_NONE){
+			ret = thread_sleep(pool->idle);
+		}
+		/* the pool is closing, or no other thread can ever run to
+		 * submit a task */
+		if (f == NULL){
+			interrupts_set(e);
+			return;
+		}
+		pool->head = f->next;
+		if (pool->head == NULL){
+			pool->tail = NULL;
+		}
+		interrupts_set(e);
 
-	cv->condition_reach = true;
-	cv-> wq = wait_queue_create();
-	cv->num_waiting = 0;
+		void *result = f->fn(f->arg);
 
-	interrupts_set(e);
-	return cv;
+		e = interrupts_off();
+		f->result = result;
+		f->done = true;
+		wakeup(&f->waiter);
+		interrupts_set(e);
+	}
 }
 
-void
-cv_destroy(struct cv *cv)
+struct pool *
+pool_create(int nthreads)
 {
 	int e = interrupts_off();
-	assert(cv != NULL);
-	assert (cv->wq != NULL);
-	free369(cv->wq);
-	cv->wq = NULL;
-	free369(cv);
+	struct pool *pool;
+
+	assert(nthreads > 0);
+	pool = malloc369(sizeof(struct pool));
+	assert(pool);
+	pool->threads = malloc369(nthreads * sizeof(Tid));
+	assert(pool->threads);
+	pool->head = NULL;
+	pool->tail = NULL;
+	pool->free = NULL;
+	pool->idle = wait_queue_create();
+	pool->nthreads = 0;
+	pool->closing = false;
+	struct thread_attr attr;
+	thread_attr_init(&attr);
+	attr.name = "pool";
+	for (int i = 0; i < nthreads; i++){
+		Tid tid = thread_create_ex(pool_thread, pool, &attr);
+		if (tid < 0){
+			break;
+		}
+		pool->threads[pool->nthreads++] = tid;
+	}
+	if (pool->nthreads == 0){
+		wait_queue_destroy(pool->idle);
+		free369(pool->threads);
+		free369(pool);
+		pool = NULL;
+	}
 	interrupts_set(e);
+	return pool;
 }
 
 void
-cv_wait(struct cv *cv, struct lock *lock)
+pool_destroy(struct pool *pool)
 {
-	assert(cv != NULL);
-	assert(lock != NULL);
-
-	if (lock->held_by != running_thread){
-		printf("thread doesn't hold the lock, can't execute cv_wait");
-		return;}
-	assert (lock->held_by == running_thread);
-	lock_release(lock);
-	++cv->num_waiting;
-	thread_sleep(cv->wq);
-	lock_acquire(lock);
+	int e = interrupts_off();
+	assert(pool != NULL);
+	pool->closing = true;
+	wakeup_all(pool->idle);
+	interrupts_set(e);
+	/* they finish the queued tasks first */
+	for (int i = 0; i < pool->nthreads; i++){
+		thread_wait(pool->threads[i], NULL);
+	}
+	e = interrupts_off();
+	while (pool->free != NULL){
+		struct future *f = pool->free;
+		pool->free = f->next;
+		free369(f);
+	}
+	wait_queue_destroy(pool->idle);
+	free369(pool->threads);
+	free369(pool);
+	interrupts_set(e);
 }
 
-void
-cv_signal(struct cv *cv, struct lock *lock)
+struct future *
+pool_submit(struct pool *pool, void *(*fn)(void *), void *arg)
 {
 	int e = interrupts_off();
-	assert(cv != NULL);
-	assert(lock != NULL);
-	if (cv->wq->head == NULL){
-		interrupts_set(e);
-		return;}
-	Tid thread_id = cv->wq->head->data;
-	--cv->num_waiting;
-	//interrupts_set(e);
-	thread_wakeup(cv->wq, false);
-	assert(lock->held_by != thread_id);
+	struct future *f;
+
+	assert(pool != NULL && !pool->closing);
+	if (pool->free != NULL){
+		f = pool->free;
+		pool->free = f->next;
+	} else {
+		f = malloc369(sizeof(struct future));
+		assert(f);
+		/* an empty wait queue */
+		memset(&f->waiter, 0, sizeof(f->waiter));
+		f->pool = pool;
+	}
+	f->fn = fn;
+	f->arg = arg;
+	f->done = false;
+	f->next = NULL;
+	if (pool->tail != NULL){
+		pool->tail->next = f;
+	} else {
+		pool->head = f;
+	}
+	pool->tail = f;
+	wakeup(pool->idle);
 	interrupts_set(e);
+	return f;
 }
 
-void
-cv_broadcast(struct cv *cv, struct lock *lock)
+void *
+future_get(struct future *f)
 {
 	int e = interrupts_off();
-	assert(cv != NULL);
-	assert(lock != NULL);
-	cv->num_waiting = 0;
-	thread_wakeup(cv->wq, true);
-	assert (cv->wq->head == NULL);
+	struct pool *pool;
+	void *result;
+	Tid ret;
+
+	assert(f != NULL);
+	if (!f->done){
+		ret = thread_sleep(&f->waiter);
+		/* nobody else can run the task */
+		assert(ret != THREAD_NONE);
+		assert(f->done);
+	}
+	result = f->result;
+	pool = f->pool;
+	f->next = pool->free;
+	pool->free = f;
 	interrupts_set(e);
-	//submitted
+	return result;
 }
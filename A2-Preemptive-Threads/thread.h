@@ -1,6 +1,9 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
+#include <sys/types.h>
+#include <sys/socket.h>
+
 /* Macro to flag places where implementation is needed in thread.c */
 #define TBD() do {							\
 		printf("%s:%d: %s: please implement this functionality\n", \
@@ -9,13 +12,27 @@
 	} while (0)
 
 
-#define THREAD_MAX_THREADS 1024 /* maximum number of threads */
+#define THREAD_MAX_THREADS 1024 /* default maximum number of threads */
+#define THREAD_MAX_THREADS_LIMIT (1 << 20) /* highest thread_set_max_threads */
 #define THREAD_MIN_STACK  32768 /* minimum per-thread execution stack */
+#define THREAD_STACK_FLOOR 16384 /* smallest stack of thread_create_ex */
+#define THREAD_MAX_STACK (1UL << 30) /* largest stack of thread_create_ex */
+#define THREAD_NAME_LEN 16 /* longest thread name, with the terminating 0 */
+#define THREAD_MAX_WORKERS 64 /* maximum number of kernel worker threads */
+
+#define THREAD_PRIO_LEVELS 8 /* number of scheduling priority levels */
+#define THREAD_PRIO_HIGHEST 0
+#define THREAD_PRIO_LOWEST (THREAD_PRIO_LEVELS-1)
+#define THREAD_PRIO_DEFAULT 2 /* priority of threads made by thread_create */
+
+#define THREAD_WEIGHT_DEFAULT 1024 /* weight of threads made by thread_create */
+#define THREAD_WEIGHT_MAX (1 << 20) /* largest weight, see thread_set_weight */
 
 typedef int Tid; /* A thread identifier */
 
 /*
- * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1. The
+ * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1, or
+ * the ceiling set with thread_set_max_threads minus one. The
  * first thread to run must have a thread id of 0. Note that this thread is the
  * main thread, i.e., it is created before the first call to thread_create.
  *
@@ -45,10 +62,45 @@ thread_ret_ok(Tid ret)
  * Assignment 1: Implement the following six functions *
  *******************************************************/
 
-/* Perform any initialization needed by your threading system. */
+/* Perform any initialization needed by your threading system. By default,
+ * all threads run on the process's initial kernel thread. If the environment
+ * variable THREAD_WORKERS is set to n > 1, this is thread_init_workers(n).
+ */
 void thread_init(void);
 
 
+/* Like thread_init, but threads run on nworkers kernel threads (M:N mode).
+ * The initial kernel thread is one of the workers. Each worker has its own
+ * ready queue, and a worker with nothing to run takes threads from the
+ * others. The thread functions, locks and condition variables work across
+ * workers, and only one worker at a time runs library code, so disabling
+ * interrupts still gives mutual exclusion. Code that uses libc functions
+ * that are not async-signal-safe (e.g., malloc or printf) should disable
+ * interrupts around them, as in single-worker mode.
+ *
+ * A thread that was preempted resumes on the worker it was preempted on, so
+ * a directed thread_yield to such a thread from another worker returns
+ * THREAD_INVALID. A thread that goes to sleep while no thread is ready on
+ * any worker returns its own identifier from thread_sleep.
+ */
+void thread_init_workers(int nworkers);
+
+/* Sets the most threads that can exist at once, including the initial thread
+ * and exited threads that have not been waited for, to max. The default is
+ * THREAD_MAX_THREADS, or the value of the environment variable
+ * THREAD_MAX_THREADS when thread_init is called. The thread table grows on
+ * demand up to the ceiling, in segments of 1024 ids, and each thread stack
+ * reserves THREAD_MIN_STACK bytes (see thread_create_ex for other sizes)
+ * plus a guard page of address space, of which a thread that has not grown
+ * its stack touches one or two pages.
+ *
+ * Upon success, returns the previous ceiling. Upon failure, returns
+ * THREAD_INVALID: max is less than 1, above THREAD_MAX_THREADS_LIMIT, or
+ * below the highest thread identifier handed out so far.
+ */
+int thread_set_max_threads(int max);
+
+
 /* Return the thread identifier of the currently running thread. */
 Tid thread_id(void);
 
@@ -110,6 +162,175 @@ void thread_exit(int exit_code);
 Tid thread_kill(Tid tid);
 
 
+/* Set the preemption quantum, i.e., the time between timer interrupts, to
+ * usecs microseconds. The default is SIG_INTERVAL (200 usec). Longer quanta
+ * switch less often and suit throughput-bound work, shorter quanta reduce
+ * the time a runnable thread waits for the CPU. This can be called at any
+ * time, before or after the interrupt handler is registered.
+ *
+ * Upon success, return the previous quantum. Upon failure, return the
+ * following:
+ *
+ * THREAD_INVALID: usecs is 0.
+ */
+long thread_set_quantum(unsigned long usecs);
+
+
+/* Like thread_create, but the new thread has priority prio, which is between
+ * THREAD_PRIO_HIGHEST (0) and THREAD_PRIO_LOWEST. Smaller values are more
+ * important. thread_create uses THREAD_PRIO_DEFAULT.
+ *
+ * The scheduler always runs a thread from the highest priority level that
+ * has ready threads. A thread's priority is where it starts: a thread that is
+ * preempted after using its whole quantum is demoted one level, and a thread
+ * that blocks in thread_sleep is boosted one level, but never above the
+ * priority it was given. All threads are periodically reset to the priority
+ * they were given, so that demoted threads are not starved.
+ *
+ * Upon failure, return THREAD_INVALID (prio is out of range) or the same
+ * errors as thread_create.
+ */
+Tid thread_create_prio(void (*fn) (void *), void *arg, int prio);
+
+
+/* Attributes of a thread made by thread_create_ex. Set them up with
+ * thread_attr_init, which gives the attributes of thread_create, then change
+ * those that should differ.
+ *
+ * stack_size: bytes of stack, between THREAD_STACK_FLOOR and
+ *	THREAD_MAX_STACK, or 0 for THREAD_MIN_STACK. Stacks of up to 512KB
+ *	are rounded up to a power of two and, like those of thread_create,
+ *	carved out of shared slabs and reused once their thread is reaped.
+ *	Larger stacks are rounded up to whole pages and get a mapping of their
+ *	own, which is unmapped when the thread is reaped. Either way a stack
+ *	is only address space until the thread touches it: the kernel commits
+ *	its pages as they are used, so a thread that blocks without growing
+ *	its stack costs a page or two whatever its stack size.
+ * prio: initial priority, see thread_create_prio.
+ * weight: CPU share under THREAD_SCHED_FAIR, see thread_set_weight.
+ * name: shown by thread_stats_dump and in thread_trace_dump's timeline, or
+ *	NULL. It is copied, truncated to THREAD_NAME_LEN - 1 characters.
+ */
+struct thread_attr {
+	size_t stack_size;
+	int prio;
+	int weight;
+	const char *name;
+};
+
+/* Set attr to the attributes of a thread made by thread_create. */
+void thread_attr_init(struct thread_attr *attr);
+
+/* Like thread_create, but the new thread has the attributes in attr, or
+ * those of thread_create if attr is NULL. Upon failure, return
+ * THREAD_INVALID (the stack size, priority or weight is out of range) or
+ * the same errors as thread_create.
+ */
+Tid thread_create_ex(void (*fn) (void *), void *arg,
+		     const struct thread_attr *attr);
+
+
+/* Set the priority of thread tid to prio, see thread_create_prio. 
+ *
+ * Upon success, return tid. Upon failure, return the following:
+ *
+ * THREAD_INVALID: identifier tid does not correspond to a valid thread, or
+ * prio is out of range.
+ */
+Tid thread_set_priority(Tid tid, int prio);
+
+
+/* Called by the interrupt handler when the running thread's quantum is up.
+ * Demotes the running thread and switches to another thread if one of at
+ * least the same priority is ready. Returns the thread that was switched to,
+ * or THREAD_NONE if the running thread keeps the CPU.
+ */
+Tid thread_preempt(void);
+
+
+/* Scheduling policies, see thread_set_sched. */
+enum {
+	THREAD_SCHED_MLFQ = 0,
+	THREAD_SCHED_FAIR = 1
+};
+
+/* Switch the scheduler to policy, moving every ready thread over.
+ *
+ * THREAD_SCHED_MLFQ, the default, is the multilevel feedback queue of
+ * thread_create_prio. Under THREAD_SCHED_FAIR the scheduler ignores
+ * priorities and shares the CPU among ready threads in proportion to their
+ * weights: it always runs the thread that has had the least CPU time for its
+ * weight (its virtual runtime), and the timer switches away from a thread as
+ * soon as another one has had less. A thread that sleeps is not owed the CPU
+ * time it missed, beyond a small head start when it wakes up. thread_init
+ * starts in THREAD_SCHED_FAIR if the environment variable THREAD_SCHED is
+ * "fair".
+ *
+ * Upon success, return the previous policy. Upon failure, return the
+ * following:
+ *
+ * THREAD_INVALID: policy is not a scheduling policy.
+ * THREAD_NOMEMORY: the ready heaps of THREAD_SCHED_FAIR could not be mapped.
+ */
+int thread_set_sched(int policy);
+
+/* Set the weight of thread tid to weight, between 1 and THREAD_WEIGHT_MAX.
+ * Under THREAD_SCHED_FAIR, CPU-bound threads get CPU time in proportion to
+ * their weights: a thread of weight 2048 gets twice the share of one of
+ * THREAD_WEIGHT_DEFAULT. Weights have no effect under THREAD_SCHED_MLFQ.
+ *
+ * Upon success, return tid. Upon failure, return the following:
+ *
+ * THREAD_INVALID: identifier tid does not correspond to a valid thread, or
+ * weight is out of range.
+ */
+Tid thread_set_weight(Tid tid, int weight);
+
+
+/* Scheduling statistics of a thread, see thread_stats. Times are in
+ * nanoseconds. */
+struct thread_stats {
+	unsigned long cpu_ns;		/* running on a worker */
+	unsigned long ready_ns;		/* runnable, waiting in a ready queue */
+	unsigned long blocked_ns;	/* asleep, e.g., in thread_sleep */
+	unsigned long yields;		/* thread_yield calls that switched */
+	unsigned long preemptions;	/* switched out by thread_preempt */
+	unsigned long sleeps;		/* times the thread went to sleep */
+	char name[THREAD_NAME_LEN];	/* see struct thread_attr, or "" */
+};
+
+/* Copy the scheduling statistics of thread tid into stats. The library
+ * always keeps them, timing state changes with the CPU's time stamp counter,
+ * which costs a few nanoseconds per context switch. A thread that has exited
+ * keeps its statistics until it is waited for.
+ *
+ * Upon success, return tid. Upon failure, return the following:
+ *
+ * THREAD_INVALID: identifier tid does not correspond to a valid thread.
+ */
+Tid thread_stats(Tid tid, struct thread_stats *stats);
+
+/* Print the statistics of every thread, and their totals, to stdout. */
+void thread_stats_dump(void);
+
+
+/* Start (on is 1) or stop (on is 0) recording scheduler events: thread
+ * creation, context switches and why they happened (yield, preemption,
+ * sleep, exit), wakeups, timer interrupts and contended lock acquisitions.
+ * Events are kept, with a time stamp counter timestamp, in a fixed-size ring
+ * that overwrites the oldest ones, and recording them does not allocate or
+ * take locks. Tracing is off by default. Returns whether it was on.
+ */
+int thread_trace_enable(int on);
+
+/* Write the events in the trace ring to the file path, as Chrome trace event
+ * JSON, which chrome://tracing and Perfetto can show as a timeline with one
+ * track per thread, labelled with the thread's name while it exists. Returns the number of events written, or -1 if the file
+ * could not be written.
+ */
+int thread_trace_dump(const char *path);
+
+
 /***************************************************
  * Assignment 2: Implement the following functions *
  **************************************************/
@@ -150,6 +371,19 @@ Tid thread_sleep(struct wait_queue *queue);
  */
 int thread_wakeup(struct wait_queue *queue, int all);
 
+/* Suspend the calling thread on addr, if *addr still equals expected, until
+ * thread_unpark(addr, ...) wakes it up. Like a futex, this lets a
+ * synchronization object be a single int that threads park on, with no wait
+ * queue to allocate: change *addr, then unpark. Returns 1 once woken up, 0
+ * right away if *addr != expected, and THREAD_NONE, without sleeping, if no
+ * other thread could ever wake the caller up.
+ */
+int thread_park(int *addr, int expected);
+
+/* Wake up to n threads parked on addr, in the order they parked. Returns the
+ * number woken up. */
+int thread_unpark(int *addr, int n);
+
 
 /* Suspend the current thread until the target thread (i.e., the thread whose 
  * identifier is tid) exits. If the target thread has already exited, then
@@ -161,7 +395,7 @@ int thread_wakeup(struct wait_queue *queue, int all);
  * Upon failure, returns THREAD_INVALID. Failure can occur for the following
  * reasons:
  *      - Identifier tid is not a feasible thread id (e.g., tid < 0 or 
- *        tid >= THREAD_MAX_THREADS) 
+ *        tid >= the thread_set_max_threads ceiling) 
  *      - No thread with the identifier tid could be found.
  *      - The identifier tid refers to the calling thread.
  *      - Another thread is already waiting for the thread with identifier tid.
@@ -169,6 +403,28 @@ int thread_wakeup(struct wait_queue *queue, int all);
 int thread_wait(Tid tid, int *exit_code);
 
 
+/* Suspend the calling thread for at least usecs microseconds. The thread uses
+ * no CPU while it sleeps. Timeouts are kept on a timer wheel with a
+ * resolution of 100 usecs, which is advanced by the timer interrupt and by
+ * workers that have nothing else to run, so a sleeping thread can wake up
+ * as much as a tick (or, with interrupts enabled, a quantum) late.
+ */
+void thread_sleep_for(unsigned long usecs);
+
+
+/* Like read(2), write(2) and accept(2), but when fd is not ready only the
+ * calling thread waits, and other threads keep running. The fd is put in
+ * non-blocking mode, and a thread that would block sleeps until epoll
+ * reports the fd ready, which is checked whenever a worker runs out of
+ * threads to run and every few timer ticks. Sockets returned by
+ * thread_accept are non-blocking. Errors are returned as by the system
+ * calls, in errno.
+ */
+ssize_t thread_read(int fd, void *buf, size_t count);
+ssize_t thread_write(int fd, const void *buf, size_t count);
+int thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+
 /* Create a blocking lock. Initially, the lock is available. 
  * Associate a wait queue with the lock so that threads that need to acquire 
  * the lock can wait in this queue. 
@@ -176,6 +432,73 @@ int thread_wait(Tid tid, int *exit_code);
 struct lock *lock_create();
 
 
+/* Lock flags for lock_create_flags.
+ *
+ * LOCK_HANDOFF: lock_release hands the lock directly to the first waiter,
+ * which then owns it even before it runs, instead of freeing the lock and
+ * letting the woken waiter race every other thread for it. Waiters acquire
+ * the lock in FIFO order, and a releasing thread cannot take the lock back
+ * before the waiter has run.
+ *
+ * LOCK_ADAPTIVE: a lock_acquire that finds the lock held yields a bounded
+ * number of times, while there are other threads to run, before sleeping, so
+ * that a short critical section does not cost a sleep and a wakeup.
+ *
+ * LOCK_PROFILE: also time how long the lock is held, which costs a clock
+ * read in lock_acquire and in lock_release, and keep histograms of hold
+ * and wait times (see struct lock_stats). Setting the environment variable
+ * THREAD_LOCK_PROFILE before thread_init profiles every lock.
+ */
+#define LOCK_HANDOFF	0x1
+#define LOCK_ADAPTIVE	0x2
+#define LOCK_PROFILE	0x4
+
+/* Create a lock with the given flags. lock_create() is
+ * lock_create_flags(0). */
+struct lock *lock_create_flags(int flags);
+
+#define LOCK_NAME_LEN 32 /* longest lock name, with the terminating 0 */
+
+/* Like lock_create_flags, but the lock is called name (copied, truncated to
+ * LOCK_NAME_LEN - 1 characters) in lock_report. */
+struct lock *lock_create_named(const char *name, int flags);
+
+/* Histograms have LOCK_HIST_BUCKETS power-of-two buckets: bucket 0 counts
+ * times below 2^LOCK_HIST_SHIFT ns, bucket i > 0 those from
+ * 2^(LOCK_HIST_SHIFT + i - 1) ns up to twice that, and the last bucket
+ * everything longer. */
+#define LOCK_HIST_BUCKETS 20
+#define LOCK_HIST_SHIFT 7	/* 128 ns */
+
+/* Per-lock counters, see lock_get_stats. */
+struct lock_stats {
+	unsigned long acquires;		/* acquisitions */
+	unsigned long contended;	/* ... that found the lock held */
+	unsigned long handoffs;		/* releases that handed the lock over */
+	unsigned long yields;		/* adaptive yields before sleeping */
+	unsigned long cv_waits;		/* cv_waits that released the lock */
+	long wait_ns;			/* total contended acquisition latency */
+	long max_wait_ns;		/* worst contended acquisition latency */
+	/* the rest is only kept for LOCK_PROFILE locks */
+	unsigned long holds;		/* releases */
+	long hold_ns;			/* total time held */
+	long max_hold_ns;		/* longest time held */
+	Tid max_hold_tid;		/* ... and by whom, or -1 */
+	unsigned long wait_hist[LOCK_HIST_BUCKETS];	/* contended waits */
+	unsigned long hold_hist[LOCK_HIST_BUCKETS];	/* hold times */
+};
+
+/* Copy the counters of lock into stats. */
+void lock_get_stats(struct lock *lock, struct lock_stats *stats);
+
+/* Print the n locks that have been contended the most, with their counters
+ * and, for LOCK_PROFILE locks, hold and wait time histograms, to stdout.
+ * Only locks that have not been destroyed are shown, ordered by contended
+ * acquisitions, then by total wait time, then by acquisitions.
+ */
+void lock_report(int n);
+
+
 /* Destroy the lock. Be sure to check that the lock is available when it is
  * being destroyed. 
  */
@@ -184,10 +507,23 @@ void lock_destroy(struct lock *lock);
 
 /* Acquire the lock. Calling threads should be suspended on the lock's wait
  * queue until they can acquire the lock. 
+ *
+ * While a thread waits, the holder of the lock runs at the waiter's
+ * priority if that is higher than its own, and so does the holder of a lock
+ * that holder waits for, and so on (priority inheritance). A thread goes
+ * back to its own priority once it releases the locks that threads of
+ * higher priority wait for, or they stop waiting.
  */
 void lock_acquire(struct lock *lock);
 
 
+/* Like lock_acquire, but give up after usecs microseconds. Returns 1 if the
+ * lock was acquired, and 0 if the time ran out first. A wait that ran out
+ * is not counted in the lock's statistics.
+ */
+int lock_acquire_timeout(struct lock *lock, unsigned long usecs);
+
+
 /* Release the lock. Be sure to check that the lock had been acquired by the
  * calling thread, before it is released. Wakeup all threads that are waiting 
  * to acquire the lock. 
@@ -211,6 +547,13 @@ void cv_destroy(struct cv *cv);
 void cv_wait(struct cv *cv, struct lock *lock);
 
 
+/* Like cv_wait, but stop waiting after usecs microseconds. The lock is
+ * reacquired in either case. Returns 1 if the thread was woken up by
+ * cv_signal or cv_broadcast, and 0 if the time ran out.
+ */
+int cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned long usecs);
+
+
 /* Wake up one thread that is waiting on the condition variable cv. Be sure to
  * check that the calling thread had acquired lock when this call is made. 
  */
@@ -222,4 +565,92 @@ void cv_signal(struct cv *cv, struct lock *lock);
  */
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/* Create a reader-writer lock. Any number of readers, or a single writer,
+ * can hold the lock at a time. Readers that arrive while a writer is waiting
+ * queue up behind it, and a writer that releases the lock lets in all the
+ * readers that are waiting, so neither side can starve the other.
+ */
+struct rwlock *rwlock_create();
+
+/* Destroy the reader-writer lock, which must not be held. */
+void rwlock_destroy(struct rwlock *rw);
+
+/* Acquire rw for reading. */
+void rwlock_rdlock(struct rwlock *rw);
+
+/* Acquire rw for writing. */
+void rwlock_wrlock(struct rwlock *rw);
+
+/* Release rw, which the calling thread holds for reading or writing. */
+void rwlock_unlock(struct rwlock *rw);
+
+/* Create a counting semaphore with the given initial value (>= 0). */
+struct semaphore *semaphore_create(int value);
+
+/* Destroy the semaphore. No thread may be waiting on it. */
+void semaphore_destroy(struct semaphore *sem);
+
+/* Wait until the value is positive, then decrement it. */
+void semaphore_down(struct semaphore *sem);
+
+/* Increment the value, or if threads are waiting, let the first one go. */
+void semaphore_up(struct semaphore *sem);
+
+/* Create a reusable barrier for nthreads threads. */
+struct barrier *barrier_create(int nthreads);
+
+/* Destroy the barrier. No thread may be waiting on it. */
+void barrier_destroy(struct barrier *b);
+
+/* Wait until nthreads threads have called barrier_wait, then let all of
+ * them continue. Returns 1 in the last thread to arrive and 0 in the others,
+ * so that one thread can do the work between phases.
+ */
+int barrier_wait(struct barrier *b);
+
+/* Create a channel that buffers up to capacity (>= 0) messages, which are
+ * pointers. With capacity 0 every send waits for a receiver. */
+struct chan *chan_create(int capacity);
+
+/* Destroy the channel. No thread may be waiting on it. Messages still in
+ * the buffer are dropped. */
+void chan_destroy(struct chan *ch);
+
+/* Send msg, waiting while the buffer is full. A receiver that is already
+ * waiting is handed msg directly, without it going through the buffer.
+ * Returns 1 once msg is sent, or 0 if the channel is closed, before or
+ * while we wait.
+ */
+int chan_send(struct chan *ch, void *msg);
+
+/* Receive the oldest message into *msg, waiting while there is none.
+ * Returns 1, or 0 once the channel is closed and all of its messages have
+ * been received.
+ */
+int chan_recv(struct chan *ch, void **msg);
+
+/* Close the channel. Sends fail from now on, and receives fail once the
+ * buffer is empty. Threads waiting on the channel return 0.
+ */
+void chan_close(struct chan *ch);
+
+/* Create a pool of nthreads threads that run tasks submitted to it. Returns
+ * NULL if no thread could be created. */
+struct pool *pool_create(int nthreads);
+
+/* Wait for every task submitted to the pool to finish, then let its threads
+ * exit and destroy it. */
+void pool_destroy(struct pool *pool);
+
+/* Queue a task that runs fn(arg) on one of the pool's threads. The returned
+ * future must be passed to future_get once, which frees it.
+ */
+struct future *pool_submit(struct pool *pool, void *(*fn)(void *), void *arg);
+
+/* Wait until the task of future f has run, and return what its fn returned.
+ * A task must not wait for a task that was submitted after it, as every
+ * thread in the pool may then be waiting.
+ */
+void *future_get(struct future *f);
+
 #endif /* _THREAD_H_ */